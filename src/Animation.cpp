@@ -0,0 +1,93 @@
+#include "Animation.h"
+
+void AnimationTrack::addKey(int frame, glm::vec3 value) {
+    Keyframe key = {frame, value};
+    auto it = std::upper_bound(keys.begin(), keys.end(), frame, [](int f, const Keyframe& k) { return f < k.frame; });
+    keys.insert(it, key);
+}
+glm::vec3 AnimationTrack::evaluate(float frame) const {
+    if(keys.empty()) return glm::vec3(0, 0, 0);
+    if(frame <= keys.front().frame) return keys.front().value;
+    if(frame >= keys.back().frame) return keys.back().value;
+    
+    // Find the pair of keys around this frame and blend between them
+    int i = 1;
+    while(keys[i].frame < frame) i++;
+    const Keyframe& a = keys[i - 1];
+    const Keyframe& b = keys[i];
+    float t = (frame - a.frame) / float(b.frame - a.frame);
+    return glm::mix(a.value, b.value, t);
+}
+/* Keyframe file format, one entry per line ('#' starts a comment):
+     frames <count>
+     output <directory>
+     camera <frame> <px> <py> <pz> <aim x> <aim y> <aim z>
+     object <scene index> <frame> <x> <y> <z>
+     light <light index> <frame> <x> <y> <z>
+*/
+bool AnimationSequence::load(string filePath) {
+    ofFile file;
+    if(!file.open(ofToDataPath(filePath), ofFile::ReadOnly)) {
+        cout << "Could not open animation file " << filePath << endl;
+        return false;
+    }
+    ofBuffer buffer = file.readToBuffer();
+    for(auto line : buffer.getLines()) {
+        stringstream stream(line);
+        string s;
+        vector<string> vec;
+        while(stream >> s) {
+            vec.push_back(s);
+        }
+        if(vec.empty() || vec[0][0] == '#') continue;
+        
+        if(vec[0] == "frames" && vec.size() >= 2) {
+            frameCount = std::stoi(vec[1]);
+        } else if(vec[0] == "output" && vec.size() >= 2) {
+            outputDirectory = vec[1];
+        } else if(vec[0] == "camera" && vec.size() >= 8) {
+            int frame = std::stoi(vec[1]);
+            cameraPosition.addKey(frame, glm::vec3(std::stof(vec[2]), std::stof(vec[3]), std::stof(vec[4])));
+            cameraAim.addKey(frame, glm::vec3(std::stof(vec[5]), std::stof(vec[6]), std::stof(vec[7])));
+        } else if((vec[0] == "object" || vec[0] == "light") && vec.size() >= 6) {
+            map<int, AnimationTrack>& tracks = vec[0] == "object" ? objectTracks : lightTracks;
+            tracks[std::stoi(vec[1])].addKey(std::stoi(vec[2]), glm::vec3(std::stof(vec[3]), std::stof(vec[4]), std::stof(vec[5])));
+        }
+    }
+    return frameCount > 0;
+}
+// One full orbit of the camera around center, keeping its height and distance.
+void AnimationSequence::turntable(glm::vec3 cameraStart, glm::vec3 center, int frames) {
+    frameCount = frames;
+    cameraPosition.keys.clear();
+    cameraAim.keys.clear();
+    
+    glm::vec3 offset = cameraStart - center;
+    float radius = glm::length(glm::vec2(offset.x, offset.z));
+    float startAngle = atan2(offset.z, offset.x);
+    for(int frame = 0; frame < frames; frame++) {
+        float angle = startAngle + TWO_PI * frame / frames;
+        glm::vec3 position = center + glm::vec3(radius * cos(angle), offset.y, radius * sin(angle));
+        cameraPosition.addKey(frame, position);
+        cameraAim.addKey(frame, glm::normalize(center - position));
+    }
+}
+FrameState AnimationSequence::evaluate(int frame) const {
+    FrameState state;
+    state.frame = frame;
+    if(!cameraPosition.empty()) {
+        state.hasCamera = true;
+        state.cameraPosition = cameraPosition.evaluate(frame);
+        state.cameraAim = cameraAim.evaluate(frame);
+    }
+    for(auto& track : objectTracks) {
+        state.objectPositions.push_back(make_pair(track.first, track.second.evaluate(frame)));
+    }
+    for(auto& track : lightTracks) {
+        state.lightPositions.push_back(make_pair(track.first, track.second.evaluate(frame)));
+    }
+    return state;
+}
+string AnimationSequence::framePath(int frame) const {
+    return outputDirectory + "/frame_" + ofToString(frame, 4, '0') + ".jpg";
+}
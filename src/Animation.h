@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  A single keyed value (position or aim) at a frame number
+//
+class Keyframe {
+public:
+    int frame;
+    glm::vec3 value;
+};
+
+//  Keyframes for one property, linearly interpolated between keys
+//
+class AnimationTrack {
+public:
+    // Methods
+    //
+    void addKey(int frame, glm::vec3 value);
+    glm::vec3 evaluate(float frame) const;
+    bool empty() const { return keys.empty(); }
+
+    // Variables
+    //
+    vector<Keyframe> keys;     // Kept sorted by frame
+};
+
+//  Everything that changes between two frames of a sequence, evaluated ahead of time
+//  so the next frame can be prepared while the current one is being traced.
+//
+class FrameState {
+public:
+    int frame = 0;
+    bool hasCamera = false;
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraAim;
+    vector<pair<int, glm::vec3>> objectPositions;   // (index into scene, position)
+    vector<pair<int, glm::vec3>> lightPositions;    // (index into sceneLights, position)
+};
+
+//  Keyframed camera, object and light transforms for rendering frames 0..frameCount-1
+//
+class AnimationSequence {
+public:
+    // Methods
+    //
+    bool load(string filePath);
+    void turntable(glm::vec3 cameraPosition, glm::vec3 center, int frames);
+    FrameState evaluate(int frame) const;
+    string framePath(int frame) const;
+
+    // Variables
+    //
+    int frameCount = 0;
+    string outputDirectory = "frames";
+    AnimationTrack cameraPosition;
+    AnimationTrack cameraAim;
+    map<int, AnimationTrack> objectTracks;
+    map<int, AnimationTrack> lightTracks;
+};
@@ -0,0 +1,22 @@
+#include "AssetLoader.h"
+
+AssetLoader::~AssetLoader() {
+    wait();
+}
+// Tiled, paged texture in TextureCache::shared(). Converting a new image happens on the pool
+std::shared_future<int> AssetLoader::loadCachedTexture(const string& filePath) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cachedTextures.find(filePath);
+    if(it != cachedTextures.end()) return it->second;
+    
+    auto handle = std::make_shared<std::promise<int>>();
+    std::shared_future<int> future = handle->get_future().share();
+    cachedTextures[filePath] = future;
+    ThreadPool::shared().enqueue([filePath, handle] { handle->set_value(TextureCache::shared().add(filePath)); });
+    return future;
+}
+// Block until everything asked for so far has loaded
+void AssetLoader::wait() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& texture : cachedTextures) texture.second.wait();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "ThreadPool.h"
+
+/*  Loads textures on the shared thread pool.
+ Every load returns a future straight away, so the scene can be set up while the files are decoded
+ in parallel, and only blocks where an asset is actually needed. Asking for the same file twice
+ returns the same future, the file is only loaded once.
+ Textures go into the shared TextureCache, which keeps them tiled on disk and only the tiles in use
+ resident.
+ */
+class AssetLoader {
+public:
+    // Methods
+    //
+    ~AssetLoader();
+    std::shared_future<int> loadCachedTexture(const string& filePath);
+    void wait();
+
+private:
+    std::mutex mutex;
+    map<string, std::shared_future<int>> cachedTextures;
+};
@@ -0,0 +1,397 @@
+#include "BVH.h"
+#include "Morton.h"
+
+static const int chunkSize = 16384;         // Primitives per task when one node's range is reduced in parallel
+static const float traversalCost = 1.0f;    // Cost of a node visit, relative to a primitive test
+static const int maxBins = 64;
+static const int maxTraversalDepth = 62;    // traverseLeaves() pushes two children a level on a 64 entry stack
+static const int wideWidth = 4;
+static const int maxWideDepth = 84;         // traverseWide() adds at most three entries a level to its 256
+
+/*  Build state for one BVH::build() call. Nodes are preallocated (a binary tree over n primitives
+ has at most 2n - 1 nodes) and handed out in pairs from an atomic counter, so parallel subtrees
+ only ever write their own nodes and their own range of the index list.
+ */
+class BVHBuilder {
+public:
+    BVHBuilder(BVH& bvh, const vector<AABB>& bounds, ThreadPool& pool) : bvh(bvh), bounds(bounds), pool(pool) {}
+    void rangeBounds(int begin, int end, AABB& box, AABB& centroidBox);
+    void buildSAH(int index, int begin, int end, int depth);
+    void sortMorton(const AABB& centroidBox);
+    void buildLBVH(int index, int begin, int end);
+    void makeLeaf(int index, int begin, int end, const AABB& box) { bvh.nodes[index] = {box, begin, end - begin}; }
+    int allocatePair() { return nodeCount.fetch_add(2); }
+
+    BVH& bvh;
+    const vector<AABB>& bounds;
+    ThreadPool& pool;
+    vector<glm::vec3> centroids;
+    vector<uint32_t> codes;         // Morton code of each entry of bvh.indices, LBVH only
+    std::atomic<int> nodeCount{1};
+};
+struct Bin {
+    AABB bounds;
+    int count = 0;
+};
+
+void BVH::build(const vector<AABB>& primitiveBounds, Method method, ThreadPool& pool) {
+    mapped.reset();
+    int count = primitiveBounds.size();
+    nodes.clear();
+    wideNodes.clear();
+    indices.resize(count);
+    if(count == 0) return;
+    nodes.resize(2 * count - 1);
+
+    BVHBuilder builder(*this, primitiveBounds, pool);
+    builder.centroids.resize(count);
+    pool.parallelFor(count, [this, &builder, &primitiveBounds](int i) {
+        indices[i] = i;
+        builder.centroids[i] = primitiveBounds[i].center();
+    }, chunkSize);
+
+    if(method == SAH) {
+        builder.buildSAH(0, 0, count, 0);
+    } else {
+        AABB box, centroidBox;
+        builder.rangeBounds(0, count, box, centroidBox);
+        builder.sortMorton(centroidBox);
+        builder.buildLBVH(0, 0, count);
+    }
+    nodes.resize(builder.nodeCount.load());
+    if(buildWide) widen();
+}
+// Use nodes and indices already laid out in file, the caller checks they're in range. Without wide
+// nodes the binary ones are traced
+void BVH::map(std::shared_ptr<MappedFile> file, size_t nodeOffset, int nodeCount, size_t indexOffset, size_t wideOffset, int wideCount) {
+    nodes.clear();
+    wideNodes.clear();
+    indices.clear();
+    mapped = file;
+    this->nodeOffset = nodeOffset;
+    this->indexOffset = indexOffset;
+    this->wideOffset = wideOffset;
+    mappedNodeCount = nodeCount;
+    mappedWideCount = wideCount;
+}
+/* For trees read from a file: every node, binary and wide, is reached once from the root within the
+ traversal stack, and every leaf's run of indices, and the primitive each names, is in range. Then
+ nothing traversal reads can be out of bounds. */
+bool BVH::isValid(int primitiveCount) const {
+    int count = nodeCount();
+    if(count == 0) return true;
+    const BVHNode* nodes = nodeData();
+    const int* indices = indexData();
+    for(int i = 0; i < primitiveCount; i++) {
+        if(indices[i] < 0 || indices[i] >= primitiveCount) return false;
+    }
+    vector<bool> visited(count, false);
+    vector<pair<int, int>> stack = {{0, 0}};     // Node, depth
+    while(!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        if(visited[index] || depth > maxTraversalDepth) return false;
+        visited[index] = true;
+        const BVHNode& node = nodes[index];
+        if(node.count > 0) {
+            if(node.first < 0 || node.first > primitiveCount - node.count) return false;
+        } else if(node.count == 0) {
+            if(node.first < 0 || node.first >= count - 1) return false;
+            stack.push_back({node.first, depth + 1});
+            stack.push_back({node.first + 1, depth + 1});
+        } else {
+            return false;
+        }
+    }
+
+    int wideCount = wideNodeCount();
+    const WideBVHNode* wide = wideNodeData();
+    vector<bool> wideVisited(wideCount, false);
+    stack = {{0, 0}};
+    while(wideCount > 0 && !stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        if(wideVisited[index] || depth > maxWideDepth) return false;
+        wideVisited[index] = true;
+        for(int c = 0; c < wideWidth; c++) {
+            int32_t child = wide[index].child[c];
+            if(child == emptyChild) continue;
+            if(child >= 0) {
+                if(child >= wideCount) return false;
+                stack.push_back({child, depth + 1});
+                continue;
+            }
+            int first = ~child >> leafCountBits, leafCount = ~child & ((1 << leafCountBits) - 1);
+            if(first > primitiveCount - leafCount) return false;
+        }
+    }
+    return true;
+}
+// Leaves that don't fit a wide node's child (see leafChild()) keep the whole tree binary
+void BVH::widen() {
+    wideNodes.clear();
+    if(nodes.empty()) return;
+    for(const BVHNode& node : nodes) {
+        if(node.count > 0 && (node.count >= 1 << leafCountBits || node.first >= 1 << (31 - leafCountBits))) return;
+    }
+    wideNodes.reserve(nodes.size() / 2 + 1);
+    widenNode(0);
+}
+// Wide node for the binary subtree at node, returns its index. Children are opened up biggest
+// surface area first until there are four, which is what an SAH tree would have split first anyway
+int BVH::widenNode(int node) {
+    int slots[wideWidth] = {node};
+    int slotCount = 1;
+    if(nodes[node].count == 0) {
+        slots[0] = nodes[node].first;
+        slots[1] = nodes[node].first + 1;
+        slotCount = 2;
+    }
+    while(slotCount < wideWidth) {
+        int widest = -1;
+        float widestArea = -1;
+        for(int s = 0; s < slotCount; s++) {
+            const BVHNode& slot = nodes[slots[s]];
+            if(slot.count == 0 && slot.bounds.surfaceArea() > widestArea) {
+                widest = s;
+                widestArea = slot.bounds.surfaceArea();
+            }
+        }
+        if(widest < 0) break;
+        int first = nodes[slots[widest]].first;
+        slots[widest] = first;
+        slots[slotCount++] = first + 1;
+    }
+
+    int index = wideNodes.size();
+    wideNodes.emplace_back();
+    int32_t children[wideWidth];
+    for(int s = 0; s < wideWidth; s++) {
+        if(s >= slotCount) children[s] = emptyChild;
+        else if(nodes[slots[s]].count > 0) children[s] = leafChild(nodes[slots[s]].first, nodes[slots[s]].count);
+        else children[s] = widenNode(slots[s]);
+    }
+
+    // Quantise the child boxes in the frame of their union, rounding down the mins and up the maxes
+    WideBVHNode& wide = wideNodes[index];
+    const AABB& box = nodes[node].bounds;
+    for(int axis = 0; axis < 3; axis++) {
+        float extent = box.max[axis] - box.min[axis];
+        wide.origin[axis] = box.min[axis];
+        wide.scale[axis] = extent > 0 ? extent * 1.0001f / 255.0f : 0.0f;
+        float inverseScale = extent > 0 ? 1.0f / wide.scale[axis] : 0.0f;
+        for(int s = 0; s < wideWidth; s++) {
+            wide.child[s] = children[s];
+            if(s >= slotCount) {
+                wide.low[axis][s] = 255;
+                wide.high[axis][s] = 0;
+                continue;
+            }
+            const AABB& child = nodes[slots[s]].bounds;
+            int low = glm::clamp((int)floor((child.min[axis] - wide.origin[axis]) * inverseScale), 0, 255);
+            int high = glm::clamp((int)ceil((child.max[axis] - wide.origin[axis]) * inverseScale), 0, 255);
+            while(low > 0 && wide.origin[axis] + low * wide.scale[axis] > child.min[axis]) low--;
+            while(high < 255 && wide.origin[axis] + high * wide.scale[axis] < child.max[axis]) high++;
+            wide.low[axis][s] = low;
+            wide.high[axis][s] = high;
+        }
+    }
+    return index;
+}
+// Bounds of the primitives in indices [begin, end) and of their centroids. Big ranges are split into chunks for the pool
+void BVHBuilder::rangeBounds(int begin, int end, AABB& box, AABB& centroidBox) {
+    int chunks = (end - begin + chunkSize - 1) / chunkSize;
+    if(chunks <= 1) {
+        for(int i = begin; i < end; i++) {
+            box.extend(bounds[bvh.indices[i]]);
+            centroidBox.extend(centroids[bvh.indices[i]]);
+        }
+        return;
+    }
+    vector<AABB> boxes(chunks), centroidBoxes(chunks);
+    pool.parallelFor(chunks, [this, begin, end, &boxes, &centroidBoxes](int c) {
+        int last = std::min(end, begin + (c + 1) * chunkSize);
+        for(int i = begin + c * chunkSize; i < last; i++) {
+            boxes[c].extend(bounds[bvh.indices[i]]);
+            centroidBoxes[c].extend(centroids[bvh.indices[i]]);
+        }
+    });
+    for(int c = 0; c < chunks; c++) {
+        box.extend(boxes[c]);
+        centroidBox.extend(centroidBoxes[c]);
+    }
+}
+/* Binned SAH: centroids are dropped into binCount bins along each axis, and the split between bins
+ with the lowest surface area cost wins, unless keeping the node as a leaf is cheaper. */
+void BVHBuilder::buildSAH(int index, int begin, int end, int depth) {
+    AABB box, centroidBox;
+    rangeBounds(begin, end, box, centroidBox);
+    int count = end - begin;
+    if(count == 1) {
+        makeLeaf(index, begin, end, box);
+        return;
+    }
+
+    int bins = glm::clamp(bvh.binCount, 2, maxBins);
+    glm::vec3 extent = centroidBox.extent();
+    glm::vec3 scale;
+    for(int axis = 0; axis < 3; axis++) {
+        scale[axis] = extent[axis] > 0 ? bins * 0.99999f / extent[axis] : 0.0f;
+    }
+    auto binIndex = [this, &centroidBox, &scale](int primitive, int axis) {
+        return (int)((centroids[primitive][axis] - centroidBox.min[axis]) * scale[axis]);
+    };
+
+    int bestAxis = -1, bestSplit = 0;
+    float bestCost = count;     // Leaf cost
+    if(depth < bvh.maxDepth && glm::max(extent.x, glm::max(extent.y, extent.z)) > 0) {
+        // Bin all three axes at once. Big ranges are binned per chunk in parallel and the chunks added up
+        Bin binned[3 * maxBins];
+        auto binRange = [this, &binIndex, bins](int first, int last, Bin* out) {
+            for(int i = first; i < last; i++) {
+                int primitive = bvh.indices[i];
+                for(int axis = 0; axis < 3; axis++) {
+                    Bin& bin = out[axis * bins + binIndex(primitive, axis)];
+                    bin.bounds.extend(bounds[primitive]);
+                    bin.count++;
+                }
+            }
+        };
+        int chunks = (count + chunkSize - 1) / chunkSize;
+        if(chunks > 1) {
+            vector<Bin> chunkBins(chunks * 3 * bins);
+            pool.parallelFor(chunks, [begin, end, bins, &chunkBins, &binRange](int c) {
+                binRange(begin + c * chunkSize, std::min(end, begin + (c + 1) * chunkSize), &chunkBins[c * 3 * bins]);
+            });
+            for(int c = 0; c < chunks; c++) {
+                for(int b = 0; b < 3 * bins; b++) {
+                    binned[b].bounds.extend(chunkBins[c * 3 * bins + b].bounds);
+                    binned[b].count += chunkBins[c * 3 * bins + b].count;
+                }
+            }
+        } else {
+            binRange(begin, end, binned);
+        }
+
+        // Sweep from the right to get the right side of every split, then from the left to price them
+        float inverseArea = 1.0f / std::max(box.surfaceArea(), 1e-20f);
+        float rightArea[maxBins];
+        int rightCount[maxBins];
+        for(int axis = 0; axis < 3; axis++) {
+            if(scale[axis] == 0) continue;
+            const Bin* axisBins = &binned[axis * bins];
+            AABB side;
+            int sideCount = 0;
+            for(int b = bins - 1; b > 0; b--) {
+                side.extend(axisBins[b].bounds);
+                sideCount += axisBins[b].count;
+                rightArea[b] = side.surfaceArea();
+                rightCount[b] = sideCount;
+            }
+            side = AABB();
+            sideCount = 0;
+            for(int b = 1; b < bins; b++) {
+                side.extend(axisBins[b - 1].bounds);
+                sideCount += axisBins[b - 1].count;
+                if(sideCount == 0 || rightCount[b] == 0) continue;
+                float cost = traversalCost + (side.surfaceArea() * sideCount + rightArea[b] * rightCount[b]) * inverseArea;
+                if(cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+    }
+
+    int middle;
+    if(bestAxis >= 0) {
+        middle = std::partition(bvh.indices.begin() + begin, bvh.indices.begin() + end,
+                                [&binIndex, bestAxis, bestSplit](int primitive) { return binIndex(primitive, bestAxis) < bestSplit; }) - bvh.indices.begin();
+    } else if(count <= bvh.maxLeafSize) {
+        makeLeaf(index, begin, end, box);
+        return;
+    } else {
+        // Too deep, or every centroid in the same spot: halve the range along the widest axis
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        middle = (begin + end) / 2;
+        std::nth_element(bvh.indices.begin() + begin, bvh.indices.begin() + middle, bvh.indices.begin() + end,
+                         [this, axis](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    }
+
+    int left = allocatePair();
+    bvh.nodes[index] = {box, left, 0};
+    if(count > bvh.parallelThreshold) {
+        pool.parallelFor(2, [this, left, begin, middle, end, depth](int side) {
+            if(side == 0) buildSAH(left, begin, middle, depth + 1);
+            else buildSAH(left + 1, middle, end, depth + 1);
+        });
+    } else {
+        buildSAH(left, begin, middle, depth + 1);
+        buildSAH(left + 1, middle, end, depth + 1);
+    }
+}
+// Puts bvh.indices in Morton order of the centroids. LSD radix sort, 10 bits a pass, stable
+void BVHBuilder::sortMorton(const AABB& centroidBox) {
+    int count = bvh.indices.size();
+    glm::vec3 extent = glm::max(centroidBox.extent(), glm::vec3(1e-20f));
+    vector<uint64_t> keys(count);      // Code in the high 32 bits, primitive in the low
+    pool.parallelFor(count, [this, &keys, &centroidBox, &extent](int i) {
+        keys[i] = (uint64_t)morton3D((centroids[i] - centroidBox.min) / extent) << 32 | i;
+    }, chunkSize);
+
+    vector<uint64_t> sorted(count);
+    for(int shift = 32; shift < 62; shift += 10) {
+        vector<int> offsets(1025, 0);
+        for(uint64_t key : keys) offsets[((key >> shift) & 1023) + 1]++;
+        for(int digit = 1; digit <= 1024; digit++) offsets[digit] += offsets[digit - 1];
+        for(uint64_t key : keys) sorted[offsets[(key >> shift) & 1023]++] = key;
+        keys.swap(sorted);
+    }
+
+    codes.resize(count);
+    for(int i = 0; i < count; i++) {
+        bvh.indices[i] = (int)(keys[i] & 0xFFFFFFFFu);
+        codes[i] = (uint32_t)(keys[i] >> 32);
+    }
+}
+// Splits where the highest bit that differs between the first and last code flips, so each side
+// is one half of the Morton cell the range spans. Runs of equal codes are just halved.
+void BVHBuilder::buildLBVH(int index, int begin, int end) {
+    int count = end - begin;
+    if(count <= bvh.maxLeafSize) {
+        AABB box;
+        for(int i = begin; i < end; i++) box.extend(bounds[bvh.indices[i]]);
+        makeLeaf(index, begin, end, box);
+        return;
+    }
+
+    int middle = (begin + end) / 2;
+    uint32_t difference = codes[begin] ^ codes[end - 1];
+    if(difference != 0) {
+        uint32_t bit = 1u << 31;
+        while(!(difference & bit)) bit >>= 1;
+        // Codes share everything above bit, so the ones with it set are a run at the end
+        int low = begin + 1, high = end - 1;
+        while(low < high) {
+            int mid = (low + high) / 2;
+            if(codes[mid] & bit) high = mid;
+            else low = mid + 1;
+        }
+        middle = low;
+    }
+
+    int left = allocatePair();
+    if(count > bvh.parallelThreshold) {
+        pool.parallelFor(2, [this, left, begin, middle, end](int side) {
+            if(side == 0) buildLBVH(left, begin, middle);
+            else buildLBVH(left + 1, middle, end);
+        });
+    } else {
+        buildLBVH(left, begin, middle);
+        buildLBVH(left + 1, middle, end);
+    }
+    AABB box = bvh.nodes[left].bounds;
+    box.extend(bvh.nodes[left + 1].bounds);
+    bvh.nodes[index] = {box, left, 0};
+}
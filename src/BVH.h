@@ -0,0 +1,196 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Ray.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SSE
+#endif
+
+struct BVHNode {
+    AABB bounds;
+    int first;          // Leaf: first entry in indices. Interior: index of the left child, right is first + 1
+    int count;          // Primitives in a leaf, 0 for interior nodes
+};
+//  Four children in one 64 byte cache line. Child boxes are quantised to 8 bits per side in the
+//  node's frame, origin + q * scale, rounded outwards so they always hold the real box.
+//
+struct alignas(64) WideBVHNode {
+    float origin[3];
+    float scale[3];
+    uint8_t low[3][4];      // [axis][child]
+    uint8_t high[3][4];
+    int32_t child[4];       // >= 0 a wide node, < 0 a leaf (see BVH::leafChild()), emptyChild if unused
+};
+
+/*  Bounding volume hierarchy over anything that has a box: the triangles of a Mesh, or the
+ objects of the scene. Two ways to build it:
+   SAH   binned surface area heuristic. Best trees, for meshes that are built once and traced a lot.
+         Big nodes bin their primitives in parallel chunks, and subtrees are built as parallel tasks.
+   LBVH  primitives sorted along a Morton curve and split on the highest differing bit of their
+         codes. Several times faster to build, trees are somewhat worse. For interactive rebuilds.
+ Nodes are one flat array, children allocated in pairs like the out of core cluster tree.
+ After building, the binary tree is collapsed into a 4-wide one for tracing: each wide node takes
+ the (up to) four biggest subtrees two levels down, so a ray tests four boxes at once with SSE,
+ does about half the node fetches, and visits the children it hits nearest first.
+ A built tree can also be mapped straight from a snapshot file instead (see Mesh), the file then
+ stays open as long as any BVH using it.
+ */
+class BVH {
+public:
+    enum Method { SAH, LBVH };
+
+    // Methods
+    //
+    void build(const vector<AABB>& primitiveBounds, Method method = SAH, ThreadPool& pool = ThreadPool::shared());
+    void map(std::shared_ptr<MappedFile> file, size_t nodeOffset, int nodeCount, size_t indexOffset, size_t wideOffset = 0, int wideCount = 0);
+    void widen();           // Collapses nodes into wideNodes, build() does it when buildWide is set
+    bool isValid(int primitiveCount) const;
+    bool isEmpty() const { return nodeCount() == 0; }
+    AABB bounds() const { return isEmpty() ? AABB() : nodeData()[0].bounds; }
+    int nodeCount() const { return mapped ? mappedNodeCount : nodes.size(); }
+    int wideNodeCount() const { return mapped ? mappedWideCount : wideNodes.size(); }
+    const BVHNode* nodeData() const { return mapped ? (const BVHNode*)(mapped->getData() + nodeOffset) : nodes.data(); }
+    const WideBVHNode* wideNodeData() const { return mapped ? (const WideBVHNode*)(mapped->getData() + wideOffset) : wideNodes.data(); }
+    const int* indexData() const { return mapped ? (const int*)(mapped->getData() + indexOffset) : indices.data(); }
+    static int32_t leafChild(int first, int count) { return ~(first << leafCountBits | count); }
+
+    // Front to back walk of the nodes the ray passes through, skipping any further than maxDistance.
+    // hit(primitive, maxDistance) is called for each primitive in those leaves, it can shrink
+    // maxDistance to prune the rest of the walk, and returning true stops it (any hit is enough).
+    template<class Hit>
+    void traverse(const Ray& ray, float& maxDistance, Hit hit) const {
+        const int* indices = indexData();
+        traverseLeaves(ray, maxDistance, [indices, &hit](int first, int count, float& maxDistance) {
+            for(int i = first; i < first + count; i++) {
+                if(hit(indices[i], maxDistance)) return true;
+            }
+            return false;
+        });
+    }
+    // Same walk, with hitLeaf(first, count, maxDistance) called once per leaf for index entries
+    // [first, first + count), for callers that test a leaf's primitives together
+    template<class HitLeaf>
+    void traverseLeaves(const Ray& ray, float& maxDistance, HitLeaf hitLeaf) const {
+        if(isEmpty()) return;
+        if(wideNodeCount() > 0) {
+            traverseWide(ray, maxDistance, hitLeaf);
+            return;
+        }
+        const BVHNode* nodes = nodeData();
+        glm::vec3 inverseDirection = 1.0f / ray.direction;
+        int stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while(stackSize > 0) {
+            const BVHNode& node = nodes[stack[--stackSize]];
+            float entry;
+            if(!node.bounds.intersect(ray.position, inverseDirection, maxDistance, entry)) continue;
+
+            if(node.count == 0) {
+                // Push the further child first so the nearer one is visited first
+                glm::vec3 leftCenter = nodes[node.first].bounds.min + nodes[node.first].bounds.max;
+                glm::vec3 rightCenter = nodes[node.first + 1].bounds.min + nodes[node.first + 1].bounds.max;
+                bool leftFirst = glm::dot(leftCenter - rightCenter, ray.direction) < 0;
+                stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+                stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+                continue;
+            }
+            if(hitLeaf(node.first, node.count, maxDistance)) return;
+        }
+    }
+
+    // Variables
+    //
+    vector<BVHNode> nodes;          // Empty when mapped
+    vector<WideBVHNode> wideNodes;  // Empty when mapped, or when the tree is traced as it was built
+    vector<int> indices;            // Primitive indices, each leaf is a contiguous run
+    int maxLeafSize = 4;
+    int binCount = 16;
+    int parallelThreshold = 4096;   // Nodes with more primitives than this build their children as parallel tasks
+    int maxDepth = 32;              // Below this SAH falls back to median splits, keeps traversal within its stack
+    bool buildWide = true;
+    static const int32_t emptyChild = std::numeric_limits<int32_t>::min();
+    static const int leafCountBits = 5;     // Leaves up to 31 primitives, starting in the first 2^26 indices, fit in a wide node
+
+private:
+    int widenNode(int node);
+
+    // Wide version of traverseLeaves(). Children that are hit go on the stack with their entry
+    // distance, furthest first, and are dropped when they come off it if a hit since is closer
+    template<class HitLeaf>
+    void traverseWide(const Ray& ray, float& maxDistance, HitLeaf& hitLeaf) const {
+        const WideBVHNode* nodes = wideNodeData();
+        glm::vec3 inverseDirection = 1.0f / ray.direction;
+        struct Entry { int32_t child; float entry; };
+        Entry stack[256];
+        int stackSize = 0;
+        stack[stackSize++] = {0, 0.0f};
+        while(stackSize > 0) {
+            Entry top = stack[--stackSize];
+            if(top.entry > maxDistance) continue;
+            if(top.child < 0) {
+                int leaf = ~top.child;
+                if(hitLeaf(leaf >> leafCountBits, leaf & ((1 << leafCountBits) - 1), maxDistance)) return;
+                continue;
+            }
+            const WideBVHNode& node = nodes[top.child];
+            float entries[4];
+            int mask = 0;
+#ifdef BVH_SSE
+            __m128 nearest = _mm_setzero_ps(), farthest = _mm_set1_ps(maxDistance);
+            for(int axis = 0; axis < 3; axis++) {
+                __m128i zero = _mm_setzero_si128();
+                int lows, highs;        // Four bytes each, copied rather than read through an int pointer
+                memcpy(&lows, node.low[axis], 4);
+                memcpy(&highs, node.high[axis], 4);
+                __m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(lows), zero), zero));
+                __m128 high = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(highs), zero), zero));
+                __m128 scale = _mm_set1_ps(node.scale[axis]), offset = _mm_set1_ps(node.origin[axis] - ray.position[axis]);
+                __m128 inverse = _mm_set1_ps(inverseDirection[axis]);
+                __m128 t0 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(low, scale), offset), inverse);
+                __m128 t1 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(high, scale), offset), inverse);
+                // NaN (0 * inf, origin on the slab of an axis the ray is parallel to) leaves the range alone
+                nearest = _mm_max_ps(_mm_min_ps(t0, t1), nearest);
+                farthest = _mm_min_ps(_mm_max_ps(t0, t1), farthest);
+            }
+            mask = _mm_movemask_ps(_mm_cmple_ps(nearest, farthest));
+            _mm_storeu_ps(entries, nearest);
+#else
+            for(int c = 0; c < 4; c++) {
+                float nearest = 0, farthest = maxDistance;
+                for(int axis = 0; axis < 3; axis++) {
+                    float offset = node.origin[axis] - ray.position[axis];
+                    float t0 = (node.low[axis][c] * node.scale[axis] + offset) * inverseDirection[axis];
+                    float t1 = (node.high[axis][c] * node.scale[axis] + offset) * inverseDirection[axis];
+                    nearest = std::max(nearest, std::min(t0, t1));
+                    farthest = std::min(farthest, std::max(t0, t1));
+                }
+                entries[c] = nearest;
+                if(nearest <= farthest) mask |= 1 << c;
+            }
+#endif
+            // Insert the hit children furthest first, so the nearest ends up on top
+            int first = stackSize;
+            for(int c = 0; c < 4; c++) {
+                if(!(mask & (1 << c)) || node.child[c] == emptyChild) continue;
+                int i = stackSize++;
+                while(i > first && stack[i - 1].entry < entries[c]) {
+                    stack[i] = stack[i - 1];
+                    i--;
+                }
+                stack[i] = {node.child[c], entries[c]};
+            }
+        }
+    }
+
+    std::shared_ptr<MappedFile> mapped;
+    size_t nodeOffset = 0;
+    size_t indexOffset = 0;
+    size_t wideOffset = 0;
+    int mappedNodeCount = 0;
+    int mappedWideCount = 0;
+};
@@ -0,0 +1,126 @@
+#include "BackgroundRenderer.h"
+#include "ofApp.h"
+
+TileQueue::TileQueue(int capacity) {
+    size_t size = 1;
+    while(size < capacity) size *= 2;
+    slots.reset(new Slot[size]);
+    mask = size - 1;
+    clear();
+}
+void TileQueue::clear() {
+    for(size_t i = 0; i <= mask; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_release);
+}
+void TileQueue::push(const glm::ivec4& tile) {
+    size_t position = head.load(std::memory_order_relaxed);
+    while(true) {
+        Slot& slot = slots[position & mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if(sequence == position) {
+            // The slot is free for this turn, claim it before another pusher does
+            if(head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                slot.tile = tile;
+                slot.sequence.store(position + 1, std::memory_order_release);
+                return;
+            }
+        } else if(sequence < position) {
+            std::this_thread::yield();     // Full, wait for the main thread to drain it
+            position = head.load(std::memory_order_relaxed);
+        } else {
+            position = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+bool TileQueue::pop(glm::ivec4& tile) {
+    size_t position = tail.load(std::memory_order_relaxed);
+    Slot& slot = slots[position & mask];
+    if(slot.sequence.load(std::memory_order_acquire) != position + 1) return false;
+    tile = slot.tile;
+    slot.sequence.store(position + mask + 1, std::memory_order_release);   // Free for the push one lap later
+    tail.store(position + 1, std::memory_order_relaxed);
+    return true;
+}
+
+BackgroundRenderer::~BackgroundRenderer() {
+    cancel();
+}
+void BackgroundRenderer::start() {
+    if(isRunning()) return;
+    preview = app.image.getPixels();        // Tiles land on top of the last frame
+    frame.allocate(app.image.getWidth(), app.image.getHeight(), OF_IMAGE_COLOR);
+    tiles.clear();
+    pixelsDone = 0;
+    pixelCount = frame.getWidth() * frame.getHeight();
+    finished = false;
+    startTime = ofGetElapsedTimeMillis();
+
+    app.cancelRender = false;
+    app.renderStarted = [this](size_t pixels) { pixelCount = std::max<size_t>(1, pixels); };
+    app.tileDone = [this](const glm::ivec4& tile) { tileDone(tile); };
+    thread = std::thread([this] {
+        app.rayTrace(frame);
+        finished.store(true, std::memory_order_release);
+    });
+}
+// Stops the render within a pixel or so per worker, and waits for it
+void BackgroundRenderer::cancel() {
+    if(!isRunning()) return;
+    app.cancelRender = true;
+    thread.join();
+    app.cancelRender = false;
+    app.renderStarted = nullptr;
+    app.tileDone = nullptr;
+    cout << "render cancelled" << endl;
+}
+float BackgroundRenderer::progress() {
+    return std::min(1.0f, float(pixelsDone.load()) / pixelCount.load());
+}
+// Called on the render's threads, the tile's pixels are in app.renderBuffer and nobody else writes them
+void BackgroundRenderer::tileDone(const glm::ivec4& tile) {
+    const RenderBuffer& buffer = app.renderBuffer;
+    for(int y = tile.y; y < tile.y + tile.w; y++) {
+        unsigned char* row = preview.getData() + (size_t(y) * preview.getWidth() + tile.x) * 3;
+        for(int x = tile.x; x < tile.x + tile.z; x++, row += 3) {
+            glm::vec3 c = glm::clamp(buffer.color[buffer.index(x, y)], 0.0f, 255.0f);
+            row[0] = c.x;
+            row[1] = c.y;
+            row[2] = c.z;
+        }
+    }
+    tiles.push(tile);
+    pixelsDone += size_t(tile.z) * tile.w;
+}
+// Copies a tile into the image's pixels and uploads just those rows and columns to its texture
+void BackgroundRenderer::upload(ofImage& image, const glm::ivec4& tile) {
+    ofPixels& pixels = image.getPixels();
+    int width = pixels.getWidth();
+    uploadRows.resize(size_t(tile.z) * tile.w * 3);
+    for(int y = 0; y < tile.w; y++) {
+        size_t offset = (size_t(tile.y + y) * width + tile.x) * 3;
+        memcpy(pixels.getData() + offset, preview.getData() + offset, tile.z * 3);
+        memcpy(&uploadRows[size_t(y) * tile.z * 3], preview.getData() + offset, tile.z * 3);
+    }
+    if(!image.isUsingTexture() || !image.getTexture().isAllocated()) return;
+    ofTexture& texture = image.getTexture();
+    texture.bind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(texture.getTextureData().textureTarget, 0, tile.x, tile.y, tile.z, tile.w, GL_RGB, GL_UNSIGNED_BYTE, uploadRows.data());
+    texture.unbind();
+}
+// Drains the finished tiles into image. When the render is done the final frame replaces the
+// preview and is saved like a foreground render
+bool BackgroundRenderer::update(ofImage& image) {
+    glm::ivec4 tile;
+    while(tiles.pop(tile)) upload(image, tile);
+    if(!isRunning() || !finished.load(std::memory_order_acquire)) return false;
+
+    thread.join();
+    app.renderStarted = nullptr;
+    app.tileDone = nullptr;
+    image.setFromPixels(frame);
+    image.save("render.jpg");
+    cout << "done in " << ofGetElapsedTimeMillis() - startTime << "ms" << endl;
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ofMain.h"
+
+class ofApp;
+
+//  Bounded lock-free queue of finished tiles (x, y, width, height in image rows, top down).
+//  Any number of threads can push, one thread pops. Each slot has a sequence number saying whose
+//  turn it is, so a push and a pop never touch the same slot at once (Vyukov's bounded queue).
+//
+class TileQueue {
+public:
+    // Methods
+    //
+    TileQueue(int capacity = 4096);    // Rounded up to a power of two
+    void push(const glm::ivec4& tile);  // Spins while the queue is full
+    bool pop(glm::ivec4& tile);
+    void clear();                       // Only while nobody pushes
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        glm::ivec4 tile;
+    };
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    std::atomic<size_t> head{0};        // Next slot to push
+    std::atomic<size_t> tail{0};        // Next slot to pop
+};
+
+/*  Runs the interactive render ('r') on its own thread so draw() and the GUI keep going.
+ The render goes through app.rayTrace() as usual. Every band or tile it finishes is quantised
+ into preview and queued, and update() drains the queue into the app's image, uploading only
+ those rectangles to the texture. Once the post passes are done the whole frame is copied in.
+ cancel() makes the tracing loops stop at their next pixel, the partial image stays on screen.
+ The scene must not be edited while isRunning(), the app holds edits back until it's done.
+ */
+class BackgroundRenderer {
+public:
+    // Methods
+    //
+    BackgroundRenderer(ofApp& app) : app(app) {}
+    ~BackgroundRenderer();
+    void start();
+    void cancel();
+    bool isRunning() { return thread.joinable(); }
+    float progress();                   // 0 - 1
+    bool update(ofImage& image);        // Call from the main thread, true when the render just finished
+
+private:
+    void tileDone(const glm::ivec4& tile);
+    void upload(ofImage& image, const glm::ivec4& tile);
+
+    ofApp& app;
+    std::thread thread;
+    TileQueue tiles;
+    ofPixels preview;                   // Tiles as they come in, each written once before it is queued
+    ofPixels frame;                     // The finished, post processed frame
+    vector<unsigned char> uploadRows;   // Scratch for a tile's rows
+    std::atomic<size_t> pixelsDone{0};
+    std::atomic<size_t> pixelCount{1};  // Of this render, a partial re-render traces fewer than the frame
+    std::atomic<bool> finished{false};
+    uint64_t startTime;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  64 bit content hashes (FNV-1a), used to key caches by what a file holds rather than its name.
+//  Not cryptographic, just enough to tell two versions of a scene apart.
+//
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+inline uint64_t hashString(const string& s, uint64_t hash = 0xcbf29ce484222325ull) {
+    return hashBytes(s.data(), s.size(), hash);
+}
+// Same idea eight bytes at a time, with a shift so high bits mix down too. Several times faster
+// for big files like meshes, but gives different values than hashBytes()
+inline uint64_t hashWords(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t words = size / 8;
+    for(size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, bytes + i * 8, 8);
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+    return hashBytes(bytes + words * 8, size % 8, hash);
+}
+// Mix a second hash into the first, order matters
+inline uint64_t hashCombine(uint64_t hash, uint64_t value) {
+    return hashBytes(&value, sizeof(value), hash);
+}
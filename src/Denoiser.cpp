@@ -0,0 +1,122 @@
+#include "Denoiser.h"
+
+static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+void Denoiser::denoise(RenderBuffer& buffer, ThreadPool& pool) {
+    width = buffer.width;
+    height = buffer.height;
+    int size = width * height;
+    for(auto plane : {&red, &green, &blue, &nextRed, &nextGreen, &nextBlue, &normalX, &normalY, &normalZ,
+                      &albedoRed, &albedoGreen, &albedoBlue, &inverseDepthScale, &inverseLuminanceScale, &depth, &objectId}) {
+        plane->resize(size);
+    }
+    
+    // Split into planes and demodulate the albedo so the filter only smooths lighting
+    pool.parallelFor(height, [this, &buffer](int y) {
+        for(int x = 0; x < width; x++) {
+            int i = buffer.index(x, y);
+            glm::vec3 a = glm::max(buffer.albedo[i], glm::vec3(0.01f));
+            red[i] = buffer.color[i].x / a.x;
+            green[i] = buffer.color[i].y / a.y;
+            blue[i] = buffer.color[i].z / a.z;
+            normalX[i] = buffer.normal[i].x;
+            normalY[i] = buffer.normal[i].y;
+            normalZ[i] = buffer.normal[i].z;
+            albedoRed[i] = buffer.albedo[i].x;
+            albedoGreen[i] = buffer.albedo[i].y;
+            albedoBlue[i] = buffer.albedo[i].z;
+            depth[i] = buffer.depth[i];
+            objectId[i] = buffer.objectId[i];
+            inverseDepthScale[i] = 1.0f / (depthSigma * buffer.depth[i] + 1e-4f);
+            // Noise in the demodulated lighting, plus one unit so noise free pixels still blend a little
+            float luminance = 0.2126f * a.x + 0.7152f * a.y + 0.0722f * a.z;
+            inverseLuminanceScale[i] = 1.0f / (luminanceSigma * sqrt(buffer.variance[i]) / luminance + 1.0f);
+        }
+    }, 4);
+    
+    for(int pass = 0, step = 1; pass < iterations; pass++, step *= 2) {
+        pool.parallelFor(height, [this, step](int y) { filterRow(y, step); }, 4);
+        red.swap(nextRed);
+        green.swap(nextGreen);
+        blue.swap(nextBlue);
+    }
+    
+    // Put the albedo back, pixels that hit nothing were never filtered
+    pool.parallelFor(height, [this, &buffer](int y) {
+        for(int x = 0; x < width; x++) {
+            int i = buffer.index(x, y);
+            if(buffer.objectId[i] < 0) continue;
+            glm::vec3 a = glm::max(buffer.albedo[i], glm::vec3(0.01f));
+            buffer.color[i] = glm::vec3(red[i], green[i], blue[i]) * a;
+        }
+    }, 4);
+}
+// Plane pointers for one row, offset so index x reads that row's pixel x
+struct RowPlanes {
+    const float *normalX, *normalY, *normalZ, *depth, *albedoRed, *albedoGreen, *albedoBlue, *red, *green, *blue, *objectId;
+    const float *inverseDepthScale, *inverseLuminanceScale;
+};
+// Accumulates one kernel tap for pixels [begin, end) of a row. The outputs are restrict
+// parameters so the compiler doesn't have to check them against every input plane.
+static void accumulateTap(const RowPlanes& c, const RowPlanes& t, int begin, int end, float k, float inverseStep, float inverseAlbedoSigma2,
+                          float* __restrict sumRed, float* __restrict sumGreen, float* __restrict sumBlue, float* __restrict sumWeight) {
+    for(int x = begin; x < end; x++) {
+        // Normals: cosine raised to the 64th power by repeated squaring
+        float n = c.normalX[x] * t.normalX[x] + c.normalY[x] * t.normalY[x] + c.normalZ[x] * t.normalZ[x];
+        n = 0.5f * (n + fabsf(n));      // max(n, 0) without a compare, keeps the loop vectorisable
+        n *= n; n *= n; n *= n; n *= n; n *= n; n *= n;
+        
+        // Depth, albedo and luminance fall off as 1 / (1 + d^2) of their scaled difference
+        float dz = (c.depth[x] - t.depth[x]) * c.inverseDepthScale[x] * inverseStep;
+        float ar = c.albedoRed[x] - t.albedoRed[x];
+        float ag = c.albedoGreen[x] - t.albedoGreen[x];
+        float ab = c.albedoBlue[x] - t.albedoBlue[x];
+        float da = (ar * ar + ag * ag + ab * ab) * inverseAlbedoSigma2;
+        float dl = (0.2126f * (c.red[x] - t.red[x]) + 0.7152f * (c.green[x] - t.green[x]) + 0.0722f * (c.blue[x] - t.blue[x])) * c.inverseLuminanceScale[x];
+        float sameObject = c.objectId[x] == t.objectId[x] ? 1.0f : 0.0f;
+        
+        float w = k * n * sameObject / ((1.0f + dz * dz) * (1.0f + da) * (1.0f + dl * dl));
+        sumRed[x] += w * t.red[x];
+        sumGreen[x] += w * t.green[x];
+        sumBlue[x] += w * t.blue[x];
+        sumWeight[x] += w;
+    }
+}
+// One a-trous pass over row y. Taps are looped outermost and pixels innermost, and taps that
+// fall off the image are skipped by trimming the pixel range, so the inner loop is branch free.
+void Denoiser::filterRow(int y, int step) {
+    vector<float> sums(width * 4, 0.0f);
+    float* sumRed = sums.data();
+    float* sumGreen = sumRed + width;
+    float* sumBlue = sumGreen + width;
+    float* sumWeight = sumBlue + width;
+    
+    auto planesAt = [this](int offset) {
+        RowPlanes planes = {normalX.data() + offset, normalY.data() + offset, normalZ.data() + offset, depth.data() + offset,
+                            albedoRed.data() + offset, albedoGreen.data() + offset, albedoBlue.data() + offset,
+                            red.data() + offset, green.data() + offset, blue.data() + offset, objectId.data() + offset,
+                            inverseDepthScale.data() + offset, inverseLuminanceScale.data() + offset};
+        return planes;
+    };
+    const int row = y * width;
+    RowPlanes center = planesAt(row);
+    
+    for(int dy = -2; dy <= 2; dy++) {
+        int yy = y + dy * step;
+        if(yy < 0 || yy >= height) continue;
+        for(int dx = -2; dx <= 2; dx++) {
+            int offset = dx * step;
+            int begin = std::max(0, -offset);
+            int end = std::min(width, width - offset);
+            accumulateTap(center, planesAt(yy * width + offset), begin, end, kernel[dy + 2] * kernel[dx + 2],
+                          1.0f / step, 1.0f / (albedoSigma * albedoSigma), sumRed, sumGreen, sumBlue, sumWeight);
+        }
+    }
+    for(int x = 0; x < width; x++) {
+        const int p = row + x;
+        bool filtered = sumWeight[x] > 0.0f;
+        nextRed[p] = filtered ? sumRed[x] / sumWeight[x] : red[p];
+        nextGreen[p] = filtered ? sumGreen[x] / sumWeight[x] : green[p];
+        nextBlue[p] = filtered ? sumBlue[x] / sumWeight[x] : blue[p];
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ofMain.h"
+#include "RenderBuffer.h"
+#include "ThreadPool.h"
+
+//  Edge-aware a-trous wavelet denoiser for low sample count renders.
+//  Lighting is divided by albedo, smoothed with a 5x5 B3-spline kernel whose taps spread out
+//  each pass (1, 2, 4, ...), and multiplied back. Each tap is weighted by how well its normal,
+//  depth, albedo, object and luminance match the centre pixel, so edges and texture survive.
+//
+class Denoiser {
+public:
+    // Methods
+    //
+    void denoise(RenderBuffer& buffer, ThreadPool& pool);
+    int radius() { return 2 * ((1 << iterations) - 1); }  // How far a pixel's result reaches, in pixels
+
+    // Variables
+    //
+    int iterations = 5;
+    float depthSigma = 0.05f;       // Relative depth difference tolerated
+    float albedoSigma = 0.1f;
+    float luminanceSigma = 4.0f;    // In standard deviations of the pixel's sample noise
+
+private:
+    void filterRow(int y, int step);
+    
+    // Planes of the frame, kept separate so the inner loops run over contiguous floats
+    int width, height;
+    vector<float> red, green, blue;
+    vector<float> nextRed, nextGreen, nextBlue;
+    vector<float> normalX, normalY, normalZ;
+    vector<float> albedoRed, albedoGreen, albedoBlue;
+    vector<float> inverseDepthScale;
+    vector<float> inverseLuminanceScale;
+    vector<float> depth;
+    vector<float> objectId;
+};
@@ -0,0 +1,251 @@
+#include "EditTracker.h"
+
+static const float nearDistance = 0.001f;
+
+// Mixes the bytes of a plain value into a hash
+template<class T>
+static uint64_t hashValue(uint64_t hash, const T& value) {
+    return hashBytes(&value, sizeof(value), hash);
+}
+// Shape and placement, for what bounds don't show: unbounded planes, a plane turned about its
+// normal, or a mesh or particle set swapped for another one with the same box
+static uint64_t geometryHash(SceneObject* obj) {
+    uint64_t hash = hashValue(0xcbf29ce484222325ull, obj->position);
+    if(Sphere* sphere = dynamic_cast<Sphere*>(obj)) hash = hashValue(hash, sphere->radius);
+    if(Plane* plane = dynamic_cast<Plane*>(obj)) {
+        hash = hashValue(hash, plane->normal);
+        hash = hashValue(hash, plane->tangent);
+        hash = hashValue(hash, plane->width);
+        hash = hashValue(hash, plane->height);
+    }
+    if(Mesh* mesh = dynamic_cast<Mesh*>(obj)) hash = hashValue(hash, mesh->getTriangleCount());
+    if(ParticleSet* particles = dynamic_cast<ParticleSet*>(obj)) hash = hashValue(hash, particles->size());
+    return hash;
+}
+static void cornersOf(const AABB& box, glm::vec3 corners[8]) {
+    for(int i = 0; i < 8; i++) {
+        corners[i] = glm::vec3(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z);
+    }
+}
+
+EditTracker::ObjectState EditTracker::stateOf(SceneObject* obj, int index) {
+    ObjectState state;
+    state.index = index;
+    state.bounds = obj->getBounds();
+    uint64_t hash = hashValue(0xcbf29ce484222325ull, obj->diffuseColor);
+    hash = hashValue(hash, obj->specularColor);
+    hash = hashValue(hash, obj->diffuseTexture);
+    hash = hashValue(hash, obj->specularTexture);
+    hash = hashValue(hash, obj->reflectivity);
+    hash = hashValue(hash, obj->celShaded);
+    Plane* plane = dynamic_cast<Plane*>(obj);
+    if(plane) {
+        // An unbounded plane's box stays empty when it moves, and a quad turned about its normal can keep its box
+        hash = hashValue(hash, plane->position);
+        hash = hashValue(hash, plane->normal);
+        hash = hashValue(hash, plane->tangent);
+        hash = hashValue(hash, plane->diffuseTextureId);
+        hash = hashValue(hash, plane->specularTextureId);
+        hash = hashValue(hash, plane->tiles);
+    }
+    state.appearance = hash;
+    return state;
+}
+uint64_t EditTracker::cameraHash(RenderCam& cam) {
+    uint64_t hash = hashValue(0xcbf29ce484222325ull, cam.position);
+    hash = hashValue(hash, cam.aim);
+    hash = hashValue(hash, cam.view.position);
+    hash = hashValue(hash, cam.view.min);
+    return hashValue(hash, cam.view.max);
+}
+uint64_t EditTracker::lightsHash(const vector<BaseLight*>& lights) {
+    uint64_t hash = hashValue(0xcbf29ce484222325ull, lights.size());
+    for(auto light : lights) {
+        hash = hashValue(hash, light->position);
+        hash = hashValue(hash, light->lightRadius);
+        hash = hashValue(hash, light->intensity);
+        hash = hashValue(hash, light->diffuseColor);
+        hash = hashValue(hash, light->specularColor);
+        SpotLight* spot = dynamic_cast<SpotLight*>(light);
+        if(spot) {
+            hash = hashValue(hash, spot->angle);
+            if(spot->anchor) hash = hashValue(hash, spot->anchor->position);
+        }
+    }
+    return hash;
+}
+void EditTracker::record(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, RenderCam& cam, int width, int height, uint64_t settings) {
+    this->width = width;
+    this->height = height;
+    this->settings = settings;
+    camera = cameraHash(cam);
+    lighting = lightsHash(lights);
+    objects.clear();
+    for(int i = 0; i < scene.size(); i++) {
+        objects[scene[i]] = stateOf(scene[i], i);
+    }
+    valid = true;
+}
+// Pixels of the recorded frame an edit since can have changed, as (u0, v0, u1, v1) in view plane
+// pixels (v bottom up), inclusive. Empty (u0 > u1) if nothing changed. False if it needs a full render
+bool EditTracker::dirtyRegion(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, RenderCam& cam, int width, int height, uint64_t settings,
+                              bool reflections, glm::ivec4& region) {
+    if(!valid || width != this->width || height != this->height || settings != this->settings ||
+       cameraHash(cam) != camera || lightsHash(lights) != lighting) {
+        return false;
+    }
+
+    // Old and new boxes of everything that changed
+    vector<AABB> changed;
+    AABB sceneBox;
+    bool unbounded = false;
+    set<SceneObject*> present;
+    for(int i = 0; i < scene.size(); i++) {
+        ObjectState now = stateOf(scene[i], i);
+        sceneBox.extend(now.bounds);
+        unbounded |= now.bounds.isEmpty();
+        present.insert(scene[i]);
+        auto it = objects.find(scene[i]);
+        if(it == objects.end()) {
+            if(now.bounds.isEmpty()) return false;
+            changed.push_back(now.bounds);
+            continue;
+        }
+        const ObjectState& before = it->second;
+        if(before.index != i) return false;     // Shifted in the list, every object id in the buffer after it is off
+        if(before.appearance == now.appearance && before.bounds.min == now.bounds.min && before.bounds.max == now.bounds.max) continue;
+        if(before.bounds.isEmpty() || now.bounds.isEmpty()) return false;
+        changed.push_back(before.bounds);
+        changed.push_back(now.bounds);
+    }
+    for(auto& object : objects) {
+        if(present.count(object.first)) continue;
+        if(object.second.bounds.isEmpty()) return false;
+        changed.push_back(object.second.bounds);
+    }
+    for(auto& box : changed) sceneBox.extend(box);
+
+    region = glm::ivec4(0, 0, -1, -1);
+    if(changed.empty()) return true;
+    if(unbounded && !lights.empty()) return false;     // Shadows can reach past sceneBox onto an infinite plane
+
+    // Same camera frame as getRay() and the rasteriser
+    cameraPosition = cam.position;
+    right = cam.toWorldDirection(glm::vec3(1, 0, 0));
+    up = cam.toWorldDirection(glm::vec3(0, 1, 0));
+    forward = -cam.toWorldDirection(glm::vec3(0, 0, 1));
+    focal = cam.position.z - cam.view.position.z;
+    pixelScale = glm::vec2(width / cam.view.width(), height / cam.view.height());
+    pixelOffset = glm::vec2(cam.position.x - cam.view.min.x, cam.position.y - cam.view.min.y);
+
+    glm::vec4 rect(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+    vector<glm::vec3> corners(8);
+    for(auto& box : changed) {
+        cornersOf(box, corners.data());
+        addHull(corners, rect);
+        for(auto light : lights) {
+            if(!addShadow(box, *light, sceneBox, rect)) return false;
+        }
+    }
+    if(reflections) {
+        for(auto obj : scene) {
+            if(obj->reflectivity <= 0) continue;
+            AABB box = obj->getBounds();
+            if(box.isEmpty()) return false;
+            cornersOf(box, corners.data());
+            addHull(corners, rect);
+        }
+    }
+
+    if(rect.x > rect.z) return true;    // All of it behind the camera
+    region = glm::ivec4(std::max(0, (int)floor(rect.x) - margin), std::max(0, (int)floor(rect.y) - margin),
+                        std::min(width - 1, (int)ceil(rect.z) + margin), std::min(height - 1, (int)ceil(rect.w) + margin));
+    if(region.x > region.z || region.y > region.w) return true;     // Off screen
+    float area = float(region.z - region.x + 1) * (region.w - region.y + 1);
+    return area <= maxFraction * width * height;
+}
+// Everything record() keeps in one hash, plus each object's geometry and content (the hash of the
+// files the scene came from, 0 if it wasn't loaded from one), for telling whether a saved frame was
+// rendered from the same state
+uint64_t EditTracker::frameHash(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, RenderCam& cam, int width, int height, uint64_t settings,
+                                uint64_t content) {
+    uint64_t hash = hashValue(hashCombine(cameraHash(cam), lightsHash(lights)), settings);
+    hash = hashValue(hash, content);
+    hash = hashValue(hash, width);
+    hash = hashValue(hash, height);
+    for(int i = 0; i < scene.size(); i++) {
+        ObjectState state = stateOf(scene[i], i);
+        hash = hashValue(hash, state.bounds);
+        hash = hashValue(hash, state.appearance);
+        hash = hashCombine(hash, geometryHash(scene[i]));
+    }
+    return hash;
+}
+// True if nothing but the camera changed since the recorded frame
+bool EditTracker::sameScene(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, int width, int height, uint64_t settings) {
+    if(!valid || width != this->width || height != this->height || settings != this->settings ||
+       scene.size() != objects.size() || lightsHash(lights) != lighting) {
+        return false;
+    }
+    for(int i = 0; i < scene.size(); i++) {
+        auto it = objects.find(scene[i]);
+        if(it == objects.end()) return false;
+        ObjectState now = stateOf(scene[i], i);
+        const ObjectState& before = it->second;
+        if(before.index != i || before.appearance != now.appearance || before.bounds.min != now.bounds.min || before.bounds.max != now.bounds.max) {
+            return false;
+        }
+    }
+    return true;
+}
+/* Everything a shadow from box can fall on, as seen from the camera. A point p is shadowed by the box
+ when p = q + t (b - q) for some q on the light, b in the box and t >= 1. For a fixed t that's a box
+ shaped set with corners q + t (b - q) over the corners of both, and the sets for t in [1, T] all
+ sit in the hull of the ones at 1 and T. T is picked so every such point at T is out of the scene. */
+bool EditTracker::addShadow(const AABB& box, BaseLight& light, const AABB& sceneBox, glm::vec4& rect) {
+    AABB lightBox(light.position - light.lightRadius, light.position + light.lightRadius);
+    glm::vec3 gap = glm::max(glm::max(box.min - lightBox.max, lightBox.min - box.max), glm::vec3(0));
+    float minDistance = glm::length(gap);
+    if(minDistance <= 0) return false;  // Light inside the box, the shadow could be anywhere
+    float maxDistance = 0;
+    glm::vec3 sceneCorners[8];
+    cornersOf(sceneBox, sceneCorners);
+    for(int i = 0; i < 8; i++) {
+        maxDistance = std::max(maxDistance, glm::distance(sceneCorners[i], light.position));
+    }
+    float t = std::max(1.0f, (maxDistance + light.lightRadius * 1.7321f) / minDistance);
+
+    glm::vec3 boxCorners[8], lightCorners[8];
+    cornersOf(box, boxCorners);
+    cornersOf(lightBox, lightCorners);
+    int lightCount = light.lightRadius > 0 ? 8 : 1;
+    vector<glm::vec3> points(boxCorners, boxCorners + 8);
+    for(int l = 0; l < lightCount; l++) {
+        for(int b = 0; b < 8; b++) {
+            points.push_back(lightCorners[l] + t * (boxCorners[b] - lightCorners[l]));
+        }
+    }
+    addHull(points, rect);
+    return true;
+}
+// Grows rect (u0, v0, u1, v1) by the convex hull of points in view plane pixels. Parts behind the
+// camera are clipped off by cutting every segment between two points at the near plane, which
+// takes care of the hull's edges without having to find them.
+void EditTracker::addHull(const vector<glm::vec3>& points, glm::vec4& rect) {
+    vector<glm::vec3> view(points.size());     // Camera space, z is the distance along forward
+    for(int i = 0; i < points.size(); i++) {
+        glm::vec3 d = points[i] - cameraPosition;
+        view[i] = glm::vec3(glm::dot(d, right), glm::dot(d, up), glm::dot(d, forward));
+    }
+    auto add = [this, &rect](const glm::vec3& q) {
+        glm::vec2 p = (focal * glm::vec2(q.x, q.y) / q.z + pixelOffset) * pixelScale - 0.5f;
+        rect = glm::vec4(std::min(rect.x, p.x), std::min(rect.y, p.y), std::max(rect.z, p.x), std::max(rect.w, p.y));
+    };
+    for(int i = 0; i < view.size(); i++) {
+        if(view[i].z >= nearDistance) add(view[i]);
+        for(int j = i + 1; j < view.size(); j++) {
+            float a = view[i].z - nearDistance, b = view[j].z - nearDistance;
+            if((a < 0) != (b < 0)) add(glm::mix(view[i], view[j], a / (a - b)));
+        }
+    }
+}
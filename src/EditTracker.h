@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "ContentHash.h"
+#include "ParticleSet.h"
+
+/*  Remembers what the last frame was rendered from, so after an edit only the pixels the edit can
+ have changed need tracing again. An edited object (moved, recoloured, added or removed) dirties
+ its old and new bounds as the camera sees them, plus everywhere it could have cast or lifted a
+ shadow: its box swept away from each light (area lights as their bounding cube) until it leaves
+ the scene. With reflections on, the pixels of every reflective object are dirty too, as they can
+ show the edit or its shadow from any angle.
+ Changes to the camera, lights or render settings, objects without bounds, edits while the scene
+ has an unbounded plane (shadows only sweep as far as the bounded objects), and regions bigger than
+ maxFraction of the frame all mean a full render.
+ */
+class EditTracker {
+public:
+    // Methods
+    //
+    void record(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, RenderCam& cam, int width, int height, uint64_t settings);
+    bool dirtyRegion(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, RenderCam& cam, int width, int height, uint64_t settings,
+                     bool reflections, glm::ivec4& region);
+    bool sameScene(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, int width, int height, uint64_t settings);
+    void invalidate() { valid = false; }
+    uint64_t frameHash(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, RenderCam& cam, int width, int height, uint64_t settings,
+                       uint64_t content = 0);
+
+    // Variables
+    //
+    float maxFraction = 0.6f;       // Dirty regions bigger than this share of the frame get a full render
+    int margin = 2;                 // Pixels added around the region, shadow rays start a little off the surface
+
+private:
+    // What an object looked like to the last render
+    struct ObjectState {
+        int index;                  // In the scene list, the render buffer's object ids refer to it
+        AABB bounds;
+        uint64_t appearance;        // Hash of the colours, textures and material
+    };
+    ObjectState stateOf(SceneObject* obj, int index);
+    uint64_t cameraHash(RenderCam& cam);
+    uint64_t lightsHash(const vector<BaseLight*>& lights);
+    bool addShadow(const AABB& box, BaseLight& light, const AABB& sceneBox, glm::vec4& rect);
+    void addHull(const vector<glm::vec3>& points, glm::vec4& rect);
+
+    bool valid = false;
+    int width, height;
+    uint64_t settings, camera, lighting;
+    map<SceneObject*, ObjectState> objects;
+
+    // Camera frame for projecting into view plane pixels, same as the rasteriser's
+    glm::vec3 cameraPosition, right, up, forward;
+    float focal;
+    glm::vec2 pixelScale, pixelOffset;
+};
@@ -0,0 +1,117 @@
+#include "ImageStream.h"
+#include <filesystem>
+
+static const char progressMagic[8] = {'R', 'T', 'S', 'T', 'R', 'M', 0, 0};
+static const uint32_t progressVersion = 1;
+
+bool ImageStream::open(const string& filePath, int width, int height) {
+    close();
+    this->width = width;
+    this->height = height;
+    rowsWritten = 0;
+    writingEnd = 0;
+    progressPath.clear();
+    file.open(ofToDataPath(filePath), std::ios::binary | std::ios::out | std::ios::trunc);
+    if(!file.is_open()) return false;
+    file << header();
+    return file.good();
+}
+// Picks up where an abandoned or crashed stream of the same frame left off, when the progress file
+// matches and the image still holds the rows it claims. Otherwise the image is started over
+int ImageStream::resume(const string& filePath, int width, int height, uint64_t frameHash) {
+    string path = ofToDataPath(filePath);
+    StreamProgress progress;
+    std::ifstream in(path + ".progress", std::ios::binary);
+    bool matches = in.read((char*)&progress, sizeof(progress)) && memcmp(progress.magic, progressMagic, 8) == 0 &&
+                   progress.version == progressVersion && progress.width == width && progress.height == height &&
+                   progress.rowsWritten <= height && progress.frameHash == frameHash;
+    in.close();
+
+    int rows = 0;
+    if(matches && progress.rowsWritten > 0) {
+        close();
+        this->width = width;
+        this->height = height;
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(path, error);
+        string expected = header();
+        if(!error && size >= expected.size() + size_t(progress.rowsWritten) * width * 3) {
+            file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+            string found(expected.size(), 0);
+            if(file.is_open() && file.read(&found[0], found.size()) && found == expected) {
+                file.seekp(expected.size() + size_t(progress.rowsWritten) * width * 3);
+                rows = progress.rowsWritten;
+            } else {
+                file.close();
+            }
+        }
+    }
+    if(rows == 0 && !open(filePath, width, height)) return -1;
+    rowsWritten = rows;
+    writingEnd = rows;
+    progressPath = path + ".progress";
+    this->frameHash = frameHash;
+    saveProgress(rows);
+    return rows;
+}
+// Append rows [firstRow, firstRow + rowCount) of the buffer to the image
+void ImageStream::writeRows(const RenderBuffer& buffer, int firstRow, int rowCount) {
+    if(!file.is_open()) return;
+    rowCount = std::min(rowCount, height - rowsWritten);
+    vector<unsigned char>& bytes = rows[current];
+    bytes.resize(size_t(width) * rowCount * 3);
+    for(int y = 0; y < rowCount; y++) {
+        for(int x = 0; x < width; x++) {
+            glm::vec3 c = glm::clamp(buffer.color[buffer.index(x, firstRow + y)], 0.0f, 255.0f);
+            unsigned char* p = &bytes[(size_t(y) * width + x) * 3];
+            p[0] = c.x;
+            p[1] = c.y;
+            p[2] = c.z;
+        }
+    }
+    rowsWritten += rowCount;
+
+    // The previous band has had a whole band's trace to finish, and is flushed once it has
+    if(writing.valid()) writing.get();
+    if(!progressPath.empty()) saveProgress(writingEnd);
+    writingEnd = rowsWritten;
+    writing = std::async(std::launch::async, [this, &bytes] {
+        file.write((const char*)bytes.data(), bytes.size());
+        file.flush();
+    });
+    current = 1 - current;
+}
+// Wait for the last band, pad out any rows never written and close. False if anything failed to write
+bool ImageStream::close() {
+    if(!file.is_open()) return false;
+    if(writing.valid()) writing.get();
+    if(rowsWritten < height) {
+        vector<unsigned char> black(size_t(width) * 3, 0);
+        for(; rowsWritten < height; rowsWritten++) file.write((const char*)black.data(), black.size());
+    }
+    bool ok = file.good();
+    file.close();
+    if(ok && !progressPath.empty()) std::remove(progressPath.c_str());
+    return ok;
+}
+void ImageStream::abandon() {
+    if(!file.is_open()) return;
+    if(writing.valid()) writing.get();
+    file.flush();
+    if(!progressPath.empty() && file.good()) saveProgress(rowsWritten);
+    file.close();
+}
+string ImageStream::header() const {
+    return "P6\n" + ofToString(width) + " " + ofToString(height) + "\n255\n";
+}
+void ImageStream::saveProgress(int rows) {
+    StreamProgress progress = {};
+    memcpy(progress.magic, progressMagic, 8);
+    progress.version = progressVersion;
+    progress.width = width;
+    progress.height = height;
+    progress.rowsWritten = rows;
+    progress.frameHash = frameHash;
+    std::ofstream out(progressPath, std::ios::binary | std::ios::trunc);
+    out.write((const char*)&progress, sizeof(progress));
+}
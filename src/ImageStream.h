@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ofMain.h"
+#include "RenderBuffer.h"
+
+//  On-disk layout of the progress file kept next to a resumable stream (<image>.progress).
+//  The image itself holds the PPM header and the first rowsWritten rows.
+//
+struct StreamProgress {
+    char magic[8];              // "RTSTRM\0\0"
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowsWritten;       // Only bumped once those rows are flushed to the image
+    uint64_t frameHash;         // Scene, camera and settings the rows were traced with
+};
+
+//  Writes an image to disk a band of rows at a time, top to bottom, as a binary PPM (P6).
+//  Rows are converted to bytes right away, so the buffer can be reused for the next band
+//  while they're written out in the background.
+//  A stream opened with resume() also keeps a progress file, so a crashed or preempted render
+//  picks up after the last rows that made it to disk. abandon() leaves both in place for that.
+//
+class ImageStream {
+public:
+    // Methods
+    //
+    ~ImageStream() { close(); }
+    bool open(const string& filePath, int width, int height);
+    int resume(const string& filePath, int width, int height, uint64_t frameHash);     // Rows already in the file, -1 if it can't be written
+    void writeRows(const RenderBuffer& buffer, int firstRow, int rowCount);
+    bool close();
+    void abandon();         // Stops at the rows written so far, without padding the image
+
+    // Variables
+    //
+    int width = 0;
+    int height = 0;
+    int rowsWritten = 0;
+
+private:
+    string header() const;
+    void saveProgress(int rows);
+
+    std::fstream file;
+    vector<unsigned char> rows[2];      // One band being written while the next is filled
+    int current = 0;
+    std::future<void> writing;
+    int writingEnd = 0;                 // rowsWritten once the band being written is on disk
+    string progressPath;                // Empty unless resumable
+    uint64_t frameHash = 0;
+};
@@ -0,0 +1,95 @@
+#include "LightClusters.h"
+
+static const int maxSlices = 32;
+
+void LightClusters::setLights(const vector<BaseLight*>& lights, float brightness) {
+    this->brightness = brightness;
+    volumes.resize(lights.size());
+    for(int l = 0; l < lights.size(); l++) {
+        LightVolume& volume = volumes[l];
+        volume.position = lights[l]->position;
+        volume.radius = influenceRadius(*lights[l]);
+        volume.halfAngle = PI;
+        // Same cone as SpotLight::getIntensity(), which lets everything through when its cosine is <= 0
+        const SpotLight* spot = dynamic_cast<const SpotLight*>(lights[l]);
+        if(spot && spot->anchor && spot->anchor->position != spot->position && std::cos(spot->angle) > 0) {
+            volume.axis = glm::normalize(spot->anchor->position - spot->position);
+            volume.halfAngle = acos((float)std::cos(spot->angle));
+        }
+    }
+}
+float LightClusters::influenceRadius(const BaseLight& light) const {
+    if(!isEnabled()) return std::numeric_limits<float>::max();
+    return sqrt(std::max(0.0f, brightness * light.intensity / cutoff));
+}
+bool LightClusters::reaches(const BaseLight& light, const glm::vec3& point) const {
+    if(!isEnabled()) return true;
+    glm::vec3 d = point - light.position;
+    return glm::dot(d, d) * cutoff <= brightness * light.intensity;
+}
+// Sphere against the box, then the cone against the box's bounding sphere
+bool LightClusters::overlaps(const LightVolume& light, const AABB& box) const {
+    glm::vec3 d = glm::clamp(light.position, box.min, box.max) - light.position;
+    if(glm::dot(d, d) > light.radius * light.radius) return false;
+    if(light.halfAngle >= PI) return true;
+
+    glm::vec3 toBox = box.center() - light.position;
+    float distance = glm::length(toBox);
+    float boxRadius = glm::length(box.extent()) * 0.5f;
+    if(distance <= boxRadius) return true;
+    float angle = acos(glm::clamp(glm::dot(toBox, light.axis) / distance, -1.0f, 1.0f));
+    return angle - asin(boxRadius / distance) <= light.halfAngle;
+}
+// Clusters for a block of primary hits, width x rows pixels. depth is the distance to each hit,
+// float max where there wasn't one
+void LightClusters::build(const glm::vec3* points, const float* depth, int width, int rows, ThreadPool& pool) {
+    this->width = width;
+    int slices = glm::clamp(depthSlices, 1, maxSlices);
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (rows + tileSize - 1) / tileSize;
+    pixelCluster.resize(width * rows);
+    clusterLights.resize(tilesX * tilesY * slices);
+
+    pool.parallelFor(tilesX * tilesY, [&](int tile) {
+        int x0 = (tile % tilesX) * tileSize, y0 = (tile / tilesX) * tileSize;
+        int x1 = std::min(width, x0 + tileSize), y1 = std::min(rows, y0 + tileSize);
+        float nearest = std::numeric_limits<float>::max(), farthest = 0;
+        for(int y = y0; y < y1; y++) {
+            for(int x = x0; x < x1; x++) {
+                float d = depth[y * width + x];
+                if(d == std::numeric_limits<float>::max()) continue;
+                nearest = std::min(nearest, d);
+                farthest = std::max(farthest, d);
+            }
+        }
+        nearest = std::max(nearest, 1e-4f);
+        float scale = farthest > nearest ? slices / log(farthest / nearest) : 0;
+
+        AABB boxes[maxSlices];
+        for(int y = y0; y < y1; y++) {
+            for(int x = x0; x < x1; x++) {
+                int i = y * width + x;
+                if(depth[i] == std::numeric_limits<float>::max()) {
+                    pixelCluster[i] = -1;
+                    continue;
+                }
+                int slice = std::min(slices - 1, std::max(0, (int)(log(std::max(depth[i], nearest) / nearest) * scale)));
+                boxes[slice].extend(points[i]);
+                pixelCluster[i] = tile * slices + slice;
+            }
+        }
+        for(int slice = 0; slice < slices; slice++) {
+            vector<int>& lights = clusterLights[tile * slices + slice];
+            lights.clear();
+            if(boxes[slice].isEmpty()) continue;
+            for(int l = 0; l < volumes.size(); l++) {
+                if(overlaps(volumes[l], boxes[slice])) lights.push_back(l);
+            }
+        }
+    }, 1);
+}
+const vector<int>& LightClusters::lightsAt(int x, int row) const {
+    static const vector<int> none;
+    int cluster = pixelCluster[row * width + x];
+    return cluster >= 0 ? clusterLights[cluster] : none;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "ThreadPool.h"
+
+/*  Light culling. Lambert and phong fall off with the square of the distance, so a light can give
+ at most brightness * intensity / d^2 colour levels, and past its influence radius that's below
+ cutoff. reaches() drops such lights the same way a spot light's cone drops the points outside it
+ (the app still shades cel shaded and reflecting hits with every light, see ofApp::needsAllLights()).
+ For the primary hits it's done a block of rows at a time: the hits are split into tileSize square
+ screen tiles and each tile into depthSlices slices, spaced evenly in log depth between the tile's
+ nearest and farthest hit. Every cluster keeps the lights whose sphere (and cone, for spots) touches
+ the box around its hits, so a pixel only loops over its cluster's lights instead of all of them.
+ A cutoff of 0 turns culling off.
+ */
+class LightClusters {
+public:
+    // Methods
+    //
+    void setLights(const vector<BaseLight*>& lights, float brightness);     // Once a frame, before the rest
+    float influenceRadius(const BaseLight& light) const;
+    bool reaches(const BaseLight& light, const glm::vec3& point) const;
+    void build(const glm::vec3* points, const float* depth, int width, int rows, ThreadPool& pool);
+    const vector<int>& lightsAt(int x, int row) const;     // Indices into the lights, for build()'s pixel (x, row)
+    bool isEnabled() const { return cutoff > 0; }
+
+    // Variables
+    //
+    float cutoff = 0.5f;        // Colour levels (of 255) a light has to be able to add to be shaded
+    int tileSize = 16;          // Pixels
+    int depthSlices = 8;
+
+private:
+    struct LightVolume {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 axis;         // Spot lights, towards the anchor
+        float halfAngle;        // PI when it lights every direction
+    };
+    bool overlaps(const LightVolume& light, const AABB& box) const;
+
+    float brightness = 0;       // Most a unit intensity light adds at distance 1, in colour levels
+    vector<LightVolume> volumes;
+    int width = 0;
+    vector<int> pixelCluster;               // Per pixel of the last build, -1 where nothing was hit
+    vector<vector<int>> clusterLights;      // tile * depthSlices + slice
+};
@@ -0,0 +1,97 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool MappedFile::open(string filePath) {
+    close();
+    HANDLE file = CreateFileA(ofToDataPath(filePath).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mapping == nullptr) {
+        CloseHandle(file);
+        return false;
+    }
+    data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(data == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    size = fileSize.QuadPart;
+    return true;
+}
+void MappedFile::close() {
+    if(data != nullptr) UnmapViewOfFile(data);
+    if(mappingHandle != nullptr) CloseHandle(mappingHandle);
+    if(fileHandle != nullptr) CloseHandle(fileHandle);
+    data = nullptr;
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+    size = 0;
+}
+// No cheap equivalent for file backed views on Windows, the working set manager handles it
+void MappedFile::adviseWillNeed(size_t offset, size_t length) {}
+void MappedFile::adviseDontNeed(size_t offset, size_t length) {}
+#else
+bool MappedFile::open(string filePath) {
+    close();
+    int fd = ::open(ofToDataPath(filePath).c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(mapping == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    fileDescriptor = fd;
+    data = (const char*)mapping;
+    size = info.st_size;
+    return true;
+}
+void MappedFile::close() {
+    if(data != nullptr) munmap((void*)data, size);
+    if(fileDescriptor >= 0) ::close(fileDescriptor);
+    data = nullptr;
+    fileDescriptor = -1;
+    size = 0;
+}
+// madvise wants page aligned ranges, round outward (neighbouring data sharing a page just refaults)
+static void adviseRange(const char* data, size_t size, size_t offset, size_t length, int advice) {
+    if(data == nullptr || length == 0) return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = offset / page * page;
+    size_t end = std::min(size, offset + length);
+    madvise((void*)(data + begin), end - begin, advice);
+}
+void MappedFile::adviseWillNeed(size_t offset, size_t length) {
+    adviseRange(data, size, offset, length, MADV_WILLNEED);
+}
+void MappedFile::adviseDontNeed(size_t offset, size_t length) {
+    adviseRange(data, size, offset, length, MADV_DONTNEED);
+}
+#endif
+
+string temporaryFilePath(const string& path) {
+#ifdef _WIN32
+    unsigned long process = GetCurrentProcessId();
+#else
+    int process = getpid();
+#endif
+    return path + ".tmp" + ofToString(process) + "_" + ofToString(std::hash<std::thread::id>()(std::this_thread::get_id()));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Read-only memory mapped file.
+//  The advise calls are hints to the OS about which ranges to page in or drop, they never
+//  invalidate the mapping, so a range dropped by one thread can still be read by another.
+//
+class MappedFile {
+public:
+    // Methods
+    //
+    MappedFile() {}
+    ~MappedFile() { close(); }
+    bool open(string filePath);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+    const char* getData() const { return data; }
+    size_t getSize() const { return size; }
+    void adviseWillNeed(size_t offset, size_t length);
+    void adviseDontNeed(size_t offset, size_t length);
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    // Variables
+    //
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+};
+
+// A name next to path that no other thread or process is writing, for building a file there and
+// renaming it over path once it's complete
+string temporaryFilePath(const string& path);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Morton (Z-order) codes, used to sort primitives and rays so that things close together
+//  in space end up close together in memory.
+//
+
+// Spread the low 10 bits of v so there are two zero bits between each of them
+inline uint32_t mortonExpandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30 bit code for a point with coordinates in [0, 1]
+inline uint32_t morton3D(glm::vec3 unit) {
+    uint32_t x = (uint32_t)glm::clamp(unit.x * 1024.0f, 0.0f, 1023.0f);
+    uint32_t y = (uint32_t)glm::clamp(unit.y * 1024.0f, 0.0f, 1023.0f);
+    uint32_t z = (uint32_t)glm::clamp(unit.z * 1024.0f, 0.0f, 1023.0f);
+    return (mortonExpandBits(x) << 2) | (mortonExpandBits(y) << 1) | mortonExpandBits(z);
+}
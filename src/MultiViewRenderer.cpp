@@ -0,0 +1,116 @@
+#include "MultiViewRenderer.h"
+#include "ofApp.h"
+
+static void basis(glm::vec3 forward, glm::vec3 upHint, ViewCamera& view) {
+    view.forward = glm::normalize(forward);
+    if(glm::abs(glm::dot(view.forward, glm::normalize(upHint))) > 0.999f) upHint = glm::abs(view.forward.z) < 0.9f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+    view.right = glm::normalize(glm::cross(view.forward, upHint));
+    view.up = glm::cross(view.right, view.forward);
+}
+
+ViewCamera ViewCamera::perspective(glm::vec3 position, glm::vec3 target, float fovDegrees, float aspect, glm::vec3 up) {
+    ViewCamera view;
+    view.projection = Perspective;
+    view.position = position;
+    basis(target - position, up, view);
+    float halfHeight = tan(glm::radians(fovDegrees) / 2);
+    view.windowMin = glm::vec2(-halfHeight * aspect, -halfHeight);
+    view.windowMax = glm::vec2(halfHeight * aspect, halfHeight);
+    return view;
+}
+ViewCamera ViewCamera::orthographic(glm::vec3 position, glm::vec3 target, float viewHeight, float aspect, glm::vec3 up) {
+    ViewCamera view;
+    view.projection = Orthographic;
+    view.position = position;
+    basis(target - position, up, view);
+    view.windowMin = glm::vec2(-viewHeight * aspect, -viewHeight) / 2.0f;
+    view.windowMax = glm::vec2(viewHeight * aspect, viewHeight) / 2.0f;
+    return view;
+}
+// Same rays as the render cam, view plane offset included
+ViewCamera ViewCamera::fromRenderCam(RenderCam& cam) {
+    ViewCamera view;
+    view.projection = Perspective;
+    view.position = cam.position;
+    view.right = cam.toWorldDirection(glm::vec3(1, 0, 0));
+    view.up = cam.toWorldDirection(glm::vec3(0, 1, 0));
+    view.forward = -cam.toWorldDirection(glm::vec3(0, 0, 1));
+    float focal = std::max(cam.position.z - cam.view.position.z, 1e-6f);
+    glm::vec2 center(cam.position.x, cam.position.y);
+    view.windowMin = (cam.view.min - center) / focal;
+    view.windowMax = (cam.view.max - center) / focal;
+    return view;
+}
+ViewCamera ViewCamera::shifted(float sideways) const {
+    ViewCamera view = *this;
+    view.position += right * sideways;
+    return view;
+}
+Ray ViewCamera::getRay(float u, float v) const {
+    glm::vec2 p = windowMin + (windowMax - windowMin) * glm::vec2(u, v);
+    if(projection == Orthographic) {
+        return Ray(position + right * p.x + up * p.y, forward);
+    }
+    return Ray(position, glm::normalize(right * p.x + up * p.y + forward));
+}
+// A pixel of a width pixel wide image is pixelSize + distance * pixelAngle wide, see ofApp::pixelFootprint()
+float ViewCamera::pixelSize(int width) const {
+    return projection == Orthographic ? (windowMax.x - windowMin.x) / width : 0;
+}
+float ViewCamera::pixelAngle(int width) const {
+    return projection == Orthographic ? 0 : (windowMax.x - windowMin.x) / width;
+}
+
+bool MultiViewRenderer::render(const vector<ViewCamera>& views, vector<ofPixels>& images) {
+    if(views.empty() || images.size() != views.size()) return false;
+    app.prepareSceneData();
+
+    // The pixel footprint is shared by all views, so take the finest any of them needs
+    app.pixelSize = std::numeric_limits<float>::max();
+    app.pixelAngle = std::numeric_limits<float>::max();
+    for(int i = 0; i < views.size(); i++) {
+        app.pixelSize = std::min(app.pixelSize, views[i].pixelSize(images[i].getWidth()));
+        app.pixelAngle = std::min(app.pixelAngle, views[i].pixelAngle(images[i].getWidth()));
+    }
+
+    // Tiles as (view, u0, v0), round robin over the views so they finish together
+    buffers.resize(views.size());
+    vector<vector<glm::ivec3>> viewTiles(views.size());
+    size_t tileCount = 0;
+    for(int i = 0; i < views.size(); i++) {
+        int width = images[i].getWidth(), height = images[i].getHeight();
+        buffers[i].allocate(width, height);
+        for(int v0 = 0; v0 < height; v0 += tileSize) {
+            for(int u0 = 0; u0 < width; u0 += tileSize) viewTiles[i].push_back(glm::ivec3(i, u0, v0));
+        }
+        tileCount += viewTiles[i].size();
+    }
+    vector<glm::ivec3> tiles;
+    tiles.reserve(tileCount);
+    for(int k = 0; tiles.size() < tileCount; k++) {
+        for(auto& list : viewTiles) {
+            if(k < list.size()) tiles.push_back(list[k]);
+        }
+    }
+
+    ThreadPool::shared().parallelFor(tiles.size(), [this, &views, &tiles](int t) {
+        const ViewCamera& view = views[tiles[t].x];
+        RenderBuffer& buffer = buffers[tiles[t].x];
+        int u1 = std::min(buffer.width, tiles[t].y + tileSize);
+        int v1 = std::min(buffer.height, tiles[t].z + tileSize);
+        for(int v = tiles[t].z; v < v1; v++) {
+            for(int u = tiles[t].y; u < u1; u++) {
+                if(app.cancelRender) return;
+                app.rayTracePixel(buffer, u, v, &view);
+            }
+        }
+    });
+    if(app.cancelRender) return false;
+
+    for(int i = 0; i < views.size(); i++) {
+        if(app.denoise) app.denoiser.denoise(buffers[i], ThreadPool::shared());
+        app.outlines.apply(buffers[i], ThreadPool::shared());
+        buffers[i].toPixels(images[i]);
+    }
+    return true;
+}
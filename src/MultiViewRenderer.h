@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "RenderBuffer.h"
+
+class ofApp;
+
+//  A camera for multi-view renders. Unlike RenderCam it isn't tied to a view plane at a fixed z,
+//  it can face any way. The window is the part of the image plane the image covers: in tangents
+//  of the view angle for perspective, in world units for orthographic. (u, v) = (0, 0) is the
+//  bottom left corner, same as RenderCam::getRay().
+//
+struct ViewCamera {
+    enum Projection { Perspective, Orthographic };
+
+    // Methods
+    //
+    static ViewCamera perspective(glm::vec3 position, glm::vec3 target, float fovDegrees, float aspect, glm::vec3 up = glm::vec3(0, 1, 0));
+    static ViewCamera orthographic(glm::vec3 position, glm::vec3 target, float viewHeight, float aspect, glm::vec3 up = glm::vec3(0, 1, 0));
+    static ViewCamera fromRenderCam(RenderCam& cam);
+    ViewCamera shifted(float sideways) const;       // Moved along right, for the eyes of a stereo pair
+    Ray getRay(float u, float v) const;
+    float pixelSize(int width) const;
+    float pixelAngle(int width) const;
+
+    // Variables
+    //
+    Projection projection = Perspective;
+    glm::vec3 position = glm::vec3(0, 0, 10);
+    glm::vec3 right = glm::vec3(1, 0, 0);
+    glm::vec3 up = glm::vec3(0, 1, 0);
+    glm::vec3 forward = glm::vec3(0, 0, -1);
+    glm::vec2 windowMin = glm::vec2(-1, -1);
+    glm::vec2 windowMax = glm::vec2(1, 1);
+};
+
+/*  Renders the scene from several cameras in one job: a hero view, a stereo pair, orthographic
+ side and top views and so on. The scene BVH, texture footprints and thread pool are set up once
+ for all of them, and the tiles of every view go into one parallelFor, interleaved, so the pool
+ never drains between views and the tiles running at once touch the same textures and meshes.
+ Each view gets its own buffer and its own denoise and outline passes. Primary hits are always
+ traced, the rasteriser's visibility buffer is only for renderCam.
+ */
+class MultiViewRenderer {
+public:
+    // Methods
+    //
+    MultiViewRenderer(ofApp& app) : app(app) {}
+    bool render(const vector<ViewCamera>& views, vector<ofPixels>& images);    // images[i] already allocated at view i's size
+
+    // Variables
+    //
+    int tileSize = 32;
+
+private:
+    ofApp& app;
+    vector<RenderBuffer> buffers;       // One per view, kept between jobs
+};
@@ -0,0 +1,264 @@
+#include "OutOfCoreMesh.h"
+#include "Morton.h"
+
+static const char outOfCoreMagic[8] = {'R', 'T', 'O', 'O', 'C', 0, 0, 0};
+static const uint32_t outOfCoreVersion = 1;
+static const int maxTreeDepth = 62;     // intersect() pushes two children a level on a 64 entry stack
+
+OutOfCoreMesh::OutOfCoreMesh(glm::vec3 position, ofColor diffuse, string clusterFile, size_t cacheBytes) {
+    this->position = position;
+    this->cacheBytes = cacheBytes;
+    diffuseColor = diffuse;
+    
+    if(!file.open(clusterFile) || file.getSize() < sizeof(OutOfCoreHeader)) {
+        cout << "Could not open cluster file " << clusterFile << endl;
+        return;
+    }
+    const OutOfCoreHeader* h = (const OutOfCoreHeader*)file.getData();
+    if(memcmp(h->magic, outOfCoreMagic, 8) != 0 || h->version != outOfCoreVersion || h->nodeCount == 0 ||
+       h->nodeOffset + (uint64_t)h->nodeCount * sizeof(OutOfCoreNode) > file.getSize() ||
+       h->clusterOffset + (uint64_t)h->clusterCount * sizeof(OutOfCoreCluster) > file.getSize() ||
+       h->triangleOffset + h->triangleCount * sizeof(PackedTriangle) > file.getSize() ||
+       (h->nodeOffset | h->clusterOffset | h->triangleOffset) % sizeof(float) != 0 ||
+       !validTables((const OutOfCoreNode*)(file.getData() + h->nodeOffset), h->nodeCount,
+                    (const OutOfCoreCluster*)(file.getData() + h->clusterOffset), h->clusterCount)) {
+        cout << "Invalid cluster file " << clusterFile << endl;
+        file.close();
+        return;
+    }
+    header = h;
+    nodes = (const OutOfCoreNode*)(file.getData() + header->nodeOffset);
+    clusters = (const OutOfCoreCluster*)(file.getData() + header->clusterOffset);
+    clusterState.reset(new std::atomic<uint8_t>[header->clusterCount]);
+    for(uint32_t c = 0; c < header->clusterCount; c++) clusterState[c] = notResident;
+}
+// Every node reached once from the root, within intersect()'s stack, and every cluster's triangles
+// inside the file, so nothing read while tracing can be out of bounds
+bool OutOfCoreMesh::validTables(const OutOfCoreNode* nodes, uint32_t nodeCount, const OutOfCoreCluster* clusters, uint32_t clusterCount) {
+    for(uint32_t c = 0; c < clusterCount; c++) {
+        if(clusters[c].triangleOffset % sizeof(float) != 0 ||
+           clusters[c].triangleOffset + (uint64_t)clusters[c].triangleCount * sizeof(PackedTriangle) > file.getSize()) {
+            return false;
+        }
+    }
+    vector<bool> visited(nodeCount, false);
+    vector<pair<uint32_t, int>> stack = {{0, 0}};     // Node, depth
+    while(!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        if(visited[index] || depth >= maxTreeDepth) return false;
+        visited[index] = true;
+        const OutOfCoreNode& node = nodes[index];
+        if(node.count == 1) {
+            if(node.first < 0 || (uint32_t)node.first >= clusterCount) return false;
+        } else if(node.count == 0) {
+            if(node.first < 0 || (uint32_t)node.first + 1 >= nodeCount) return false;
+            stack.push_back({node.first, depth + 1});
+            stack.push_back({node.first + 1, depth + 1});
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+// Returns the cluster's triangles and records the use, evicting old clusters when over budget.
+// Eviction only tells the OS the pages can go, so a pointer another thread holds stays readable.
+const PackedTriangle* OutOfCoreMesh::touchCluster(int cluster) {
+    const OutOfCoreCluster& c = clusters[cluster];
+    const PackedTriangle* triangles = (const PackedTriangle*)(file.getData() + c.triangleOffset);
+    std::atomic<uint8_t>& state = clusterState[cluster];
+    uint8_t current = state.load(std::memory_order_relaxed);
+    if(current == used) return triangles;
+    if(current == resident) {
+        state.compare_exchange_strong(current, used, std::memory_order_relaxed);    // Fails if it was just evicted, the next touch loads it
+        return triangles;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if(state.load(std::memory_order_relaxed) != notResident) return triangles;     // Another thread got here first
+    size_t bytes = c.triangleCount * sizeof(PackedTriangle);
+    file.adviseWillNeed(c.triangleOffset, bytes);
+    lru.push_front(cluster);
+    state = resident;
+    residentBytes += bytes;
+
+    // Clusters used since the last pass move back to the front, at most once each
+    size_t looked = 0, residentCount = lru.size();
+    while(residentBytes > cacheBytes && lru.size() > 1) {
+        int oldest = lru.back();
+        uint8_t expected = used;
+        if(looked++ < residentCount && clusterState[oldest].compare_exchange_strong(expected, resident, std::memory_order_relaxed)) {
+            lru.splice(lru.begin(), lru, std::prev(lru.end()));
+            continue;
+        }
+        lru.pop_back();
+        const OutOfCoreCluster& e = clusters[oldest];
+        file.adviseDontNeed(e.triangleOffset, e.triangleCount * sizeof(PackedTriangle));
+        clusterState[oldest] = notResident;
+        residentBytes -= e.triangleCount * sizeof(PackedTriangle);
+    }
+    return triangles;
+}
+bool OutOfCoreMesh::intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) {
+    if(!isLoaded()) return false;
+    
+    WatertightRay wray(ray);
+    glm::vec3 inverseDirection = 1.0f / ray.direction;
+    float shortest = std::numeric_limits<float>::max();
+    glm::vec3 v1, v2, v3;   // Closest triangle so far
+    bool hit = false;
+    
+    // Front to back traversal of the cluster tree, skipping nodes further than the closest hit
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0) {
+        const OutOfCoreNode& node = nodes[stack[--stackSize]];
+        float entry;
+        AABB box(glm::vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]), glm::vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]));
+        if(!box.intersect(ray.position, inverseDirection, shortest, entry)) continue;
+        
+        if(node.count == 0) {
+            // Push the further child first so the nearer one is visited first
+            const OutOfCoreNode& left = nodes[node.first];
+            const OutOfCoreNode& right = nodes[node.first + 1];
+            glm::vec3 leftCenter = glm::vec3(left.boundsMin[0] + left.boundsMax[0], left.boundsMin[1] + left.boundsMax[1], left.boundsMin[2] + left.boundsMax[2]);
+            glm::vec3 rightCenter = glm::vec3(right.boundsMin[0] + right.boundsMax[0], right.boundsMin[1] + right.boundsMax[1], right.boundsMin[2] + right.boundsMax[2]);
+            bool leftFirst = glm::dot(leftCenter - rightCenter, ray.direction) < 0;
+            stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+            stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+            continue;
+        }
+        
+        const OutOfCoreCluster& cluster = clusters[node.first];
+        const PackedTriangle* triangles = touchCluster(node.first);
+        for(int i = 0; i < cluster.triangleCount; i++) {
+            float distance;
+            if(wray.intersect(triangles[i].v1, triangles[i].v2, triangles[i].v3, distance) && distance > 0.001f && distance < shortest) {
+                shortest = distance;
+                v1 = triangles[i].v1;
+                v2 = triangles[i].v2;
+                v3 = triangles[i].v3;
+                hit = true;
+            }
+        }
+    }
+    if(hit) {
+        Ray r = ray;
+        point = r.evalPoint(shortest);
+        normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
+    }
+    return hit;
+}
+// Root node bounds, from the resident node table
+AABB OutOfCoreMesh::getBounds() {
+    if(!isLoaded()) return AABB();
+    return AABB(glm::vec3(nodes[0].boundsMin[0], nodes[0].boundsMin[1], nodes[0].boundsMin[2]),
+                glm::vec3(nodes[0].boundsMax[0], nodes[0].boundsMax[1], nodes[0].boundsMax[2]));
+}
+// Drawing the triangles would page in the whole mesh, just show its bounds
+void OutOfCoreMesh::draw() {
+    if(!isLoaded()) return;
+    glm::vec3 boundsMin = glm::vec3(nodes[0].boundsMin[0], nodes[0].boundsMin[1], nodes[0].boundsMin[2]);
+    glm::vec3 boundsMax = glm::vec3(nodes[0].boundsMax[0], nodes[0].boundsMax[1], nodes[0].boundsMax[2]);
+    glm::vec3 size = boundsMax - boundsMin;
+    ofPushStyle();
+    ofNoFill();
+    ofDrawBox((boundsMin + boundsMax) * 0.5f, size.x, size.y, size.z);
+    ofPopStyle();
+}
+
+// Fills node index with the subtree over clusters [begin, end), children are allocated in pairs
+static void buildClusterTree(vector<OutOfCoreNode>& nodes, const vector<AABB>& bounds, int index, int begin, int end) {
+    AABB box;
+    for(int i = begin; i < end; i++) box.extend(bounds[i]);
+    OutOfCoreNode& node = nodes[index];
+    for(int axis = 0; axis < 3; axis++) {
+        node.boundsMin[axis] = box.min[axis];
+        node.boundsMax[axis] = box.max[axis];
+    }
+    if(end - begin == 1) {
+        node.first = begin;
+        node.count = 1;
+        return;
+    }
+    int left = nodes.size();
+    nodes.resize(nodes.size() + 2);
+    nodes[index].first = left;
+    nodes[index].count = 0;
+    int middle = (begin + end) / 2;     // Clusters are in Morton order, so halving the range splits space
+    buildClusterTree(nodes, bounds, left, begin, middle);
+    buildClusterTree(nodes, bounds, left + 1, middle, end);
+}
+/* Offline conversion from an OBJ file to a cluster file.
+ Triangles are sorted along a Morton curve through their centroids and cut into clusters of
+ trianglesPerCluster, so every cluster is spatially compact. The conversion itself holds the
+ whole mesh in memory, run it once on a machine big enough and ship the cluster file. */
+bool OutOfCoreMesh::convert(string objPath, string clusterFile, int trianglesPerCluster) {
+    Mesh mesh(glm::vec3(0, 0, 0), ofColor::grey, objPath);
+    vector<PackedTriangle> triangles(mesh.packedData(), mesh.packedData() + mesh.getTriangleCount());     // Might be mapped from a snapshot
+    if(triangles.empty()) return false;
+    trianglesPerCluster = std::max(1, trianglesPerCluster);
+    
+    AABB meshBounds;
+    for(const PackedTriangle& tri : triangles) {
+        meshBounds.extend(tri.v1);
+        meshBounds.extend(tri.v2);
+        meshBounds.extend(tri.v3);
+    }
+    glm::vec3 extent = glm::max(meshBounds.extent(), glm::vec3(1e-6f));
+    
+    vector<pair<uint32_t, uint32_t>> order(triangles.size());  // (morton code, triangle)
+    for(uint32_t i = 0; i < triangles.size(); i++) {
+        glm::vec3 centroid = (triangles[i].v1 + triangles[i].v2 + triangles[i].v3) / 3.0f;
+        order[i] = make_pair(morton3D((centroid - meshBounds.min) / extent), i);
+    }
+    std::sort(order.begin(), order.end());
+    
+    int clusterCount = (triangles.size() + trianglesPerCluster - 1) / trianglesPerCluster;
+    vector<OutOfCoreCluster> clusters(clusterCount);
+    vector<AABB> clusterBounds(clusterCount);
+    vector<OutOfCoreNode> nodes(1);
+    
+    OutOfCoreHeader header = {};
+    memcpy(header.magic, outOfCoreMagic, 8);
+    header.version = outOfCoreVersion;
+    header.clusterCount = clusterCount;
+    header.trianglesPerCluster = trianglesPerCluster;
+    header.triangleCount = triangles.size();
+    
+    for(int c = 0; c < clusterCount; c++) {
+        int begin = c * trianglesPerCluster;
+        int end = std::min<int>(begin + trianglesPerCluster, triangles.size());
+        for(int i = begin; i < end; i++) {
+            const PackedTriangle& tri = triangles[order[i].second];
+            clusterBounds[c].extend(tri.v1);
+            clusterBounds[c].extend(tri.v2);
+            clusterBounds[c].extend(tri.v3);
+        }
+        for(int axis = 0; axis < 3; axis++) {
+            clusters[c].boundsMin[axis] = clusterBounds[c].min[axis];
+            clusters[c].boundsMax[axis] = clusterBounds[c].max[axis];
+        }
+        clusters[c].triangleCount = end - begin;
+    }
+    buildClusterTree(nodes, clusterBounds, 0, 0, clusterCount);
+    
+    header.nodeCount = nodes.size();
+    header.nodeOffset = sizeof(OutOfCoreHeader);
+    header.clusterOffset = header.nodeOffset + nodes.size() * sizeof(OutOfCoreNode);
+    header.triangleOffset = header.clusterOffset + clusters.size() * sizeof(OutOfCoreCluster);
+    for(int c = 0; c < clusterCount; c++) {
+        clusters[c].triangleOffset = header.triangleOffset + (uint64_t)c * trianglesPerCluster * sizeof(PackedTriangle);
+    }
+    
+    std::ofstream out(ofToDataPath(clusterFile), std::ios::binary);
+    if(!out) return false;
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)nodes.data(), nodes.size() * sizeof(OutOfCoreNode));
+    out.write((const char*)clusters.data(), clusters.size() * sizeof(OutOfCoreCluster));
+    for(auto& entry : order) {
+        out.write((const char*)&triangles[entry.second], sizeof(PackedTriangle));
+    }
+    return out.good();
+}
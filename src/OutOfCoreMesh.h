@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "MappedFile.h"
+
+//  On-disk layout of a cluster file, everything is little endian and offsets are from the file start:
+//    OutOfCoreHeader
+//    OutOfCoreNode[nodeCount]         binary tree over the clusters, node 0 is the root
+//    OutOfCoreCluster[clusterCount]
+//    PackedTriangle[triangleCount]    grouped by cluster, each cluster is a contiguous run
+//
+struct OutOfCoreHeader {
+    char magic[8];              // "RTOOC\0\0\0"
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t clusterCount;
+    uint32_t trianglesPerCluster;
+    uint64_t triangleCount;
+    uint64_t nodeOffset;
+    uint64_t clusterOffset;
+    uint64_t triangleOffset;
+};
+struct OutOfCoreNode {
+    float boundsMin[3];
+    float boundsMax[3];
+    int32_t first;              // Leaf: cluster index. Interior: index of the left child, right is first + 1
+    int32_t count;              // 1 for leaves, 0 for interior nodes
+};
+struct OutOfCoreCluster {
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t triangleOffset;    // Byte offset of the cluster's triangles
+    uint32_t triangleCount;
+    uint32_t padding;
+};
+
+//  Mesh whose triangles stay on disk in a memory mapped cluster file.
+//  The node and cluster tables are small and always resident. Triangle clusters are paged
+//  in on first touch and dropped again once more than cacheBytes of them are resident, in
+//  clock order: the oldest first, unless it was used since it was last looked at, then it
+//  gets another round. Touching a resident cluster is one atomic, only misses take the lock.
+//
+class OutOfCoreMesh : public SceneObject {
+public:
+    // Methods
+    //
+    OutOfCoreMesh(glm::vec3 position, ofColor diffuse, string clusterFile, size_t cacheBytes = 512 * 1024 * 1024);
+    bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal);
+    AABB getBounds();
+    void draw();
+    bool isLoaded() { return header != nullptr; }
+    static bool convert(string objPath, string clusterFile, int trianglesPerCluster = 1024);
+
+    // Variables
+    //
+    size_t cacheBytes;
+    size_t residentBytes = 0;
+    
+private:
+    const PackedTriangle* touchCluster(int cluster);
+    bool validTables(const OutOfCoreNode* nodes, uint32_t nodeCount, const OutOfCoreCluster* clusters, uint32_t clusterCount);
+    
+    MappedFile file;
+    const OutOfCoreHeader* header = nullptr;
+    const OutOfCoreNode* nodes = nullptr;
+    const OutOfCoreCluster* clusters = nullptr;
+    
+    // Resident clusters, newest at the front
+    enum ClusterState : uint8_t { notResident, resident, used };
+    std::mutex cacheMutex;
+    std::list<int> lru;
+    std::unique_ptr<std::atomic<uint8_t>[]> clusterState;
+};
@@ -0,0 +1,68 @@
+#include "OutlineFilter.h"
+
+void OutlineFilter::apply(RenderBuffer& buffer, ThreadPool& pool) {
+    if(thickness <= 0) return;
+    width = buffer.width;
+    height = buffer.height;
+    int size = width * height;
+    for(auto plane : {&normalX, &normalY, &normalZ, &depth, &objectId, &edge}) {
+        plane->resize(size);
+    }
+    offsets.clear();
+    for(int dy = -thickness; dy <= thickness; dy++) {
+        for(int dx = -thickness; dx <= thickness; dx++) {
+            if((dx != 0 || dy != 0) && dx * dx + dy * dy <= thickness * thickness) offsets.push_back(glm::ivec2(dx, dy));
+        }
+    }
+
+    pool.parallelFor(height, [this, &buffer](int y) {
+        for(int x = 0; x < width; x++) {
+            int i = buffer.index(x, y);
+            normalX[i] = buffer.normal[i].x;
+            normalY[i] = buffer.normal[i].y;
+            normalZ[i] = buffer.normal[i].z;
+            depth[i] = buffer.depth[i];
+            objectId[i] = buffer.objectId[i];
+        }
+    }, 4);
+    pool.parallelFor(height, [this, &buffer](int y) { filterRow(y, buffer); }, 4);
+}
+// Plane pointers for one row, offset so index x reads that row's pixel x
+struct FeatureRow {
+    const float *normalX, *normalY, *normalZ, *depth, *objectId;
+};
+// Marks pixels [begin, end) of a row that one tap finds an edge for. Written without branches so the loop vectorises
+static void markTap(const FeatureRow& c, const FeatureRow& t, int begin, int end, float depthThreshold, float creaseCosine, float* __restrict edge) {
+    for(int x = begin; x < end; x++) {
+        float hit = c.objectId[x] >= 0 ? 1.0f : 0.0f;
+        float nearer = c.depth[x] <= t.depth[x] ? 1.0f : 0.0f;
+        float otherObject = c.objectId[x] != t.objectId[x] ? 1.0f : 0.0f;
+        float depthJump = t.depth[x] - c.depth[x] > depthThreshold * c.depth[x] ? 1.0f : 0.0f;
+        float crease = c.normalX[x] * t.normalX[x] + c.normalY[x] * t.normalY[x] + c.normalZ[x] * t.normalZ[x] < creaseCosine ? 1.0f : 0.0f;
+        edge[x] += hit * nearer * (otherObject + depthJump + crease);
+    }
+}
+void OutlineFilter::filterRow(int y, RenderBuffer& buffer) {
+    auto row = [this](int y) {
+        int offset = y * width;
+        return FeatureRow{&normalX[offset], &normalY[offset], &normalZ[offset], &depth[offset], &objectId[offset]};
+    };
+    FeatureRow center = row(y);
+    float* rowEdge = &edge[y * width];
+    std::fill(rowEdge, rowEdge + width, 0.0f);
+    for(auto& offset : offsets) {
+        int ty = y + offset.y;
+        if(ty < 0 || ty >= height) continue;
+        // Shift the tap row so index x reads pixel x + dx, and keep x + dx inside the row
+        FeatureRow tap = row(ty);
+        tap.normalX += offset.x;
+        tap.normalY += offset.x;
+        tap.normalZ += offset.x;
+        tap.depth += offset.x;
+        tap.objectId += offset.x;
+        markTap(center, tap, std::max(0, -offset.x), std::min(width, width - offset.x), depthThreshold, creaseCosine, rowEdge);
+    }
+    for(int x = 0; x < width; x++) {
+        if(rowEdge[x] > 0) buffer.color[buffer.index(x, y)] = color;
+    }
+}
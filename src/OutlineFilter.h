@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ofMain.h"
+#include "RenderBuffer.h"
+#include "ThreadPool.h"
+
+//  Cel outlines drawn as a post pass over the render buffer's features, so they cost no rays and
+//  work for any primitive. A hit pixel is drawn in outline colour when a pixel within thickness
+//  of it shows something behind it: another object, the background, a jump in depth on the same
+//  object, or the same surface turned sharply away (a crease). Lines go on the nearer side of an
+//  edge, so silhouettes sit on the object like the old grazing ray test's did.
+//
+class OutlineFilter {
+public:
+    // Methods
+    //
+    void apply(RenderBuffer& buffer, ThreadPool& pool);
+
+    // Variables
+    //
+    int thickness = 1;              // Pixels, 0 turns outlines off
+    float depthThreshold = 0.1f;    // Relative depth jump on one object that counts as an edge
+    float creaseCosine = 0.5f;      // Normals further apart than this are a crease (60 degrees)
+    glm::vec3 color = glm::vec3(0, 0, 0);
+
+private:
+    void filterRow(int y, RenderBuffer& buffer);
+
+    // Planes of the features, kept separate so the tap loops run over contiguous floats
+    int width, height;
+    vector<float> normalX, normalY, normalZ;
+    vector<float> depth;
+    vector<float> objectId;
+    vector<float> edge;             // Non zero where a row's pixel is outline
+    vector<glm::ivec2> offsets;     // Taps inside the thickness disc
+};
@@ -0,0 +1,230 @@
+#include "ParticleSet.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PARTICLES_SSE
+#endif
+
+static const char particleMagic[8] = {'R', 'T', 'P', 'A', 'R', 'T', 0, 0};
+static const uint32_t particleVersion = 1;
+static const int particleLeafSize = 8;      // Two groups of four
+static const int lbvhThreshold = 1 << 18;   // Bigger sets build with LBVH, SAH takes seconds there and gains little on evenly spread particles
+static const float nearDistance = 0.001f;   // Same cutoff shortestIntersection() uses
+static std::atomic<uint64_t> nextSetId{1};
+
+// Last particle looked up from a point on each thread
+struct ParticleLookup {
+    uint64_t owner = 0;
+    glm::vec3 point;
+    int particle = -1;
+};
+
+ParticleSet::ParticleSet(ofColor diffuse) {
+    diffuseColor = diffuse;
+    id = nextSetId++;
+}
+ParticleSet::ParticleSet(string filePath, ofColor diffuse) : ParticleSet(diffuse) {
+    if(!load(filePath)) cout << "Could not load particles " << filePath << endl;
+}
+// False if the file is missing, from another version, or shorter than its header says, all checked
+// before anything is allocated
+bool ParticleSet::load(const string& filePath) {
+    std::ifstream file(ofToDataPath(filePath), std::ios::binary | std::ios::ate);
+    uint64_t fileSize = file ? (uint64_t)file.tellg() : 0;
+    file.seekg(0);
+    ParticleFileHeader header;
+    if(!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, particleMagic, 8) != 0 ||
+       header.version != particleVersion || header.paletteSize > 256 || header.particleCount > (uint64_t)std::numeric_limits<int>::max() ||
+       sizeof(header) + header.paletteSize * 3 + header.particleCount * (4 * sizeof(float) + (header.hasColors ? 1 : 0)) > fileSize) {
+        return false;
+    }
+    vector<uint8_t> rgb(header.paletteSize * 3);
+    vector<float> packed(header.particleCount * 4);
+    file.read((char*)rgb.data(), rgb.size());
+    file.read((char*)packed.data(), packed.size() * sizeof(float));
+    vector<uint8_t> colors(header.hasColors ? header.particleCount : 0);
+    file.read((char*)colors.data(), colors.size());
+    if(!file) return false;
+
+    palette.clear();
+    for(int i = 0; i < header.paletteSize; i++) palette.push_back(ofColor(rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]));
+    count = header.particleCount;
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    radius.resize(count);
+    for(size_t i = 0; i < count; i++) {
+        x[i] = packed[i * 4];
+        y[i] = packed[i * 4 + 1];
+        z[i] = packed[i * 4 + 2];
+        radius[i] = packed[i * 4 + 3];
+    }
+    colorIndex.swap(colors);
+    build();
+    return true;
+}
+bool ParticleSet::save(const string& filePath) {
+    ParticleFileHeader header = {};
+    memcpy(header.magic, particleMagic, 8);
+    header.version = particleVersion;
+    header.paletteSize = std::min<int>(palette.size(), 256);
+    header.particleCount = count;
+    header.hasColors = !colorIndex.empty();
+    vector<uint8_t> rgb;
+    for(int i = 0; i < header.paletteSize; i++) {
+        rgb.insert(rgb.end(), {palette[i].r, palette[i].g, palette[i].b});
+    }
+    vector<float> packed(size_t(count) * 4);
+    for(size_t i = 0; i < count; i++) {
+        packed[i * 4] = x[i];
+        packed[i * 4 + 1] = y[i];
+        packed[i * 4 + 2] = z[i];
+        packed[i * 4 + 3] = radius[i];
+    }
+    std::ofstream file(ofToDataPath(filePath), std::ios::binary | std::ios::trunc);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)rgb.data(), rgb.size());
+    file.write((const char*)packed.data(), packed.size() * sizeof(float));
+    if(header.hasColors) file.write((const char*)colorIndex.data(), count);
+    return file.good();
+}
+void ParticleSet::add(glm::vec3 center, float r, int color) {
+    // Drop build()'s padding
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    radius.resize(count);
+    x.push_back(center.x);
+    y.push_back(center.y);
+    z.push_back(center.z);
+    radius.push_back(r);
+    if(color != 0 || !colorIndex.empty()) {
+        colorIndex.resize(count, 0);
+        colorIndex.push_back(color);
+    }
+    count++;
+}
+// Builds the hierarchy and moves the particles into its leaf order, like Mesh::buildBVH()
+void ParticleSet::build() {
+    vector<AABB> bounds(count);
+    ThreadPool::shared().parallelFor(count, [this, &bounds](int i) {
+        glm::vec3 c(x[i], y[i], z[i]);
+        bounds[i] = AABB(c - radius[i], c + radius[i]);
+    }, 4096);
+    bvh.maxLeafSize = particleLeafSize;
+    bvh.build(bounds, count > lbvhThreshold ? BVH::LBVH : BVH::SAH);
+
+    auto reorder = [this](auto& values) {
+        typename std::remove_reference<decltype(values)>::type ordered(count);
+        for(int i = 0; i < count; i++) ordered[i] = values[bvh.indices[i]];
+        values.swap(ordered);
+    };
+    reorder(x);
+    reorder(y);
+    reorder(z);
+    reorder(radius);
+    if(!colorIndex.empty()) reorder(colorIndex);
+    for(int i = 0; i < count; i++) bvh.indices[i] = i;
+
+    for(auto values : {&x, &y, &z}) values->resize(count + 3, 0.0f);
+    radius.resize(count + 3, -1.0f);
+    if(count > 0) position = bvh.bounds().center();
+}
+// Closest particle the ray hits within maxDistance, which is shrunk to its distance. -1 if none.
+// direction has to be unit length
+int ParticleSet::nearestHit(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance) {
+    int closest = -1;
+    bvh.traverseLeaves(Ray(origin, direction), maxDistance, [&](int first, int leafCount, float& maxDistance) {
+#ifdef PARTICLES_SSE
+        __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+        __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+        __m128 nearest = _mm_set1_ps(nearDistance), zero = _mm_setzero_ps();
+        for(int base = first; base < first + leafCount; base += 4) {
+            // Same test as glm::intersectRaySphere(): the far root when the near one is behind the ray
+            __m128 cx = _mm_sub_ps(_mm_loadu_ps(&x[base]), ox);
+            __m128 cy = _mm_sub_ps(_mm_loadu_ps(&y[base]), oy);
+            __m128 cz = _mm_sub_ps(_mm_loadu_ps(&z[base]), oz);
+            __m128 r = _mm_loadu_ps(&radius[base]);
+            __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, dx), _mm_mul_ps(cy, dy)), _mm_mul_ps(cz, dz));
+            __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz));
+            __m128 inside = _mm_sub_ps(_mm_mul_ps(r, r), _mm_sub_ps(lengthSquared, _mm_mul_ps(along, along)));
+            __m128 half = _mm_sqrt_ps(_mm_max_ps(inside, zero));
+            __m128 nearRoot = _mm_sub_ps(along, half);
+            __m128 farRoot = _mm_add_ps(along, half);
+            __m128 useNear = _mm_cmpgt_ps(nearRoot, nearest);
+            __m128 t = _mm_or_ps(_mm_and_ps(useNear, nearRoot), _mm_andnot_ps(useNear, farRoot));
+            __m128 hit = _mm_and_ps(_mm_cmpge_ps(inside, zero), _mm_and_ps(_mm_cmpgt_ps(t, nearest), _mm_cmplt_ps(t, _mm_set1_ps(maxDistance))));
+            hit = _mm_and_ps(hit, _mm_cmpge_ps(r, zero));
+            int mask = _mm_movemask_ps(hit);
+            if(mask == 0) continue;
+            float distances[4];
+            _mm_storeu_ps(distances, t);
+            for(int lane = 0; lane < 4 && base + lane < first + leafCount; lane++) {
+                if((mask & (1 << lane)) && distances[lane] < maxDistance) {
+                    maxDistance = distances[lane];
+                    closest = base + lane;
+                }
+            }
+        }
+#else
+        for(int i = first; i < first + leafCount; i++) {
+            glm::vec3 toCenter = glm::vec3(x[i], y[i], z[i]) - origin;
+            float along = glm::dot(toCenter, direction);
+            float inside = radius[i] * radius[i] - (glm::dot(toCenter, toCenter) - along * along);
+            if(inside < 0) continue;
+            float half = sqrt(inside);
+            float t = along - half > nearDistance ? along - half : along + half;
+            if(t > nearDistance && t < maxDistance) {
+                maxDistance = t;
+                closest = i;
+            }
+        }
+#endif
+        return false;
+    });
+    return closest;
+}
+bool ParticleSet::intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) {
+    glm::vec3 direction = glm::normalize(ray.direction);
+    float distance = std::numeric_limits<float>::max();
+    int i = nearestHit(ray.position, direction, distance);
+    if(i < 0) return false;
+    point = ray.position + direction * distance;
+    normal = glm::normalize(point - glm::vec3(x[i], y[i], z[i]));
+    return true;
+}
+// Walks the particles around point with a short ray and picks the one whose surface it's closest to
+int ParticleSet::particleAt(const glm::vec3& point) {
+    static thread_local ParticleLookup last;
+    if(last.owner == id && last.point == point) return last.particle;
+
+    float best = std::numeric_limits<float>::max();
+    int particle = -1;
+    float reach = 1e-3f * (1.0f + glm::length(point));
+    float maxDistance = 2 * reach;
+    glm::vec3 direction = glm::normalize(glm::vec3(1, 1, 1));
+    bvh.traverseLeaves(Ray(point - direction * reach, direction), maxDistance, [&](int first, int leafCount, float&) {
+        for(int i = first; i < first + leafCount; i++) {
+            float error = glm::abs(glm::distance(point, glm::vec3(x[i], y[i], z[i])) - radius[i]);
+            if(error < best) {
+                best = error;
+                particle = i;
+            }
+        }
+        return false;
+    });
+    last = {id, point, particle};
+    return particle;
+}
+ofColor ParticleSet::getDiffuseColor(glm::vec3 intersection, float footprint) {
+    if(colorIndex.empty() || palette.empty()) return diffuseColor;
+    int i = particleAt(intersection);
+    if(i < 0) return diffuseColor;
+    return palette[std::min<int>(colorIndex[i], palette.size() - 1)];
+}
+void ParticleSet::draw() {
+    int step = std::max(1, count / std::max(1, maxDrawn));
+    for(int i = 0; i < count; i += step) {
+        ofDrawSphere(glm::vec3(x[i], y[i], z[i]), radius[i]);
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "BVH.h"
+
+//  On-disk layout of a particle dump, little endian, no padding between sections:
+//    ParticleFileHeader
+//    uint8_t[paletteSize * 3]          rgb colours
+//    float[particleCount * 4]          x, y, z, radius per particle
+//    uint8_t[particleCount]            palette index per particle, only if hasColors
+//
+struct ParticleFileHeader {
+    char magic[8];              // "RTPART\0\0"
+    uint32_t version;
+    uint32_t paletteSize;       // At most 256
+    uint64_t particleCount;
+    uint32_t hasColors;
+    uint32_t padding;
+};
+
+/*  Millions of spheres as one scene object. Centres and radii live in plain float arrays (structure
+ of arrays) with an optional one byte palette index each: 17 bytes a particle, 30-40 with its share
+ of the BVH, instead of a few hundred for a Sphere. Particles are stored in the BVH's leaf order, so
+ a leaf is a contiguous run of them, and leaves are tested four spheres at a time with SSE where
+ it's available.
+ Colours come from the palette when there is one, otherwise every particle is diffuseColor. The
+ hit particle is found again from the point for getDiffuseColor(), which is cached per thread so
+ shading one hit for several lights looks it up once.
+ */
+class ParticleSet : public SceneObject {
+public:
+    // Methods
+    //
+    ParticleSet(ofColor diffuse = ofColor::lightGray);
+    ParticleSet(string filePath, ofColor diffuse = ofColor::lightGray);
+    bool load(const string& filePath);
+    bool save(const string& filePath);
+    void add(glm::vec3 center, float radius, int colorIndex = 0);
+    void build();           // After add()ing particles, before tracing
+    bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal);
+    AABB getBounds() { return bvh.bounds(); }
+    ofColor getDiffuseColor(glm::vec3 intersection, float footprint = 0);
+    void draw();
+    int size() const { return count; }
+    int particleAt(const glm::vec3& point);     // Particle whose surface point is on, -1 if none
+
+    // Variables
+    //
+    vector<ofColor> palette;
+    int maxDrawn = 2000;    // Particles drawn in the preview, evenly spread over the set
+
+private:
+    int nearestHit(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance);
+
+    int count = 0;
+    vector<float> x, y, z, radius;      // Padded to a multiple of 4 past count, so a leaf's last group can be loaded whole
+    vector<uint8_t> colorIndex;         // Empty without colours
+    BVH bvh;
+    uint64_t id;                        // Tags the per thread colour lookup cache
+};
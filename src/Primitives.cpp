@@ -7,6 +7,16 @@
 
 #include "Primitives.h"
 
+static const char snapshotMagic[8] = {'R', 'T', 'M', 'E', 'S', 'H', 0, 0};
+static const uint32_t snapshotVersion = 2;
+static const size_t snapshotAlignment = 64;
+
+string Mesh::snapshotDirectory = "cache/meshes";
+
+static uint64_t alignUp(uint64_t offset) {
+    return (offset + snapshotAlignment - 1) / snapshotAlignment * snapshotAlignment;
+}
+
 Sphere::Sphere(glm::vec3 position, float radius, ofColor diffuse, float reflectivity, bool celShaded) {
     this->position = position;
     this->radius = radius;
@@ -14,42 +24,290 @@ Sphere::Sphere(glm::vec3 position, float radius, ofColor diffuse, float reflecti
     this->celShaded = celShaded;
     diffuseColor = diffuse;
 }
-Mesh::Mesh(glm::vec3 position, ofColor diffuse, string filePath) {
+Mesh::Mesh(glm::vec3 position, ofColor diffuse, string filePath, bool quantized) {
     this->position = position;
+    this->quantized = quantized;
     diffuseColor = diffuse;
+
+    // Key on the file's contents, not its name, so an edited OBJ never picks up a stale snapshot
+    string snapshotPath;
+    uint64_t sourceHash = 0;
+    if(!snapshotDirectory.empty()) {
+        MappedFile source;
+        if(source.open(ofToDataPath(filePath))) {
+            sourceHash = hashCombine(hashWords(source.getData(), source.getSize()), quantized);
+            snapshotPath = ofToDataPath(snapshotDirectory + "/" + ofToHex(sourceHash) + ".mesh");
+            if(loadSnapshot(snapshotPath, sourceHash)) return;
+        }
+    }
+
     vertices.push_back(glm::vec3(0, 0, 0));
     parseFile(filePath);
+    buildTriangles();
+    if(snapshotPath.empty()) return;
+    if(!saveSnapshot(snapshotPath, sourceHash)) {
+        cout << "Could not write mesh snapshot " << snapshotPath << endl;
+        return;
+    }
+    // Trace from the snapshot just written as well, which frees what was built and lets copies share it
+    loadSnapshot(snapshotPath, sourceHash);
+}
+// Maps a snapshot written by saveSnapshot() and traces straight from it. False if it's missing,
+// from another source or build, cut short, or its tree could send a traversal out of bounds
+bool Mesh::loadSnapshot(const string& snapshotPath, uint64_t sourceHash) {
+    auto file = std::make_shared<MappedFile>();
+    if(!file->open(snapshotPath) || file->getSize() < sizeof(MeshSnapshotHeader)) return false;
+    const MeshSnapshotHeader* h = (const MeshSnapshotHeader*)file->getData();
+    size_t triangleSize = quantized ? sizeof(QuantizedTriangle) : sizeof(PackedTriangle);
+    if(memcmp(h->magic, snapshotMagic, 8) != 0 || h->version != snapshotVersion || h->sourceHash != sourceHash ||
+       h->quantized != (uint32_t)quantized || h->nodeSize != sizeof(BVHNode) || h->triangleSize != triangleSize ||
+       h->triangleCount > (uint64_t)std::numeric_limits<int>::max() || h->nodeCount > 2 * h->triangleCount ||
+       h->nodeOffset + h->nodeCount * sizeof(BVHNode) > file->getSize() ||
+       h->indexOffset + h->triangleCount * sizeof(int32_t) > file->getSize() ||
+       h->triangleOffset + h->triangleCount * triangleSize > file->getSize() ||
+       h->wideNodeSize != sizeof(WideBVHNode) || h->wideNodeCount > h->nodeCount ||
+       h->wideNodeOffset + h->wideNodeCount * sizeof(WideBVHNode) > file->getSize() ||
+       (h->nodeOffset | h->indexOffset | h->triangleOffset | h->wideNodeOffset) % snapshotAlignment != 0) {
+        return false;
+    }
+
+    BVH mappedBVH;
+    mappedBVH.map(file, h->nodeOffset, h->nodeCount, h->indexOffset, h->wideNodeOffset, h->wideNodeCount);
+    if(!mappedBVH.isValid(h->triangleCount)) return false;
+
+    vector<PackedTriangle>().swap(packedTriangles);
+    vector<QuantizedTriangle>().swap(quantizedTriangles);
+    vector<glm::vec3>().swap(vertices);
+    vector<Triangle>().swap(triangles);
+    boundsMin = glm::vec3(h->boundsMin[0], h->boundsMin[1], h->boundsMin[2]);
+    quantizeScale = glm::vec3(h->quantizeScale[0], h->quantizeScale[1], h->quantizeScale[2]);
+    triangleOffset = h->triangleOffset;
+    mappedTriangleCount = h->triangleCount;
+    bvh = std::move(mappedBVH);
+    snapshot = file;
+    return true;
+}
+/* Writes the triangles and BVH as they are in memory, each section 64 byte aligned. Written under
+ a temporary name and renamed like the tiled textures, so another process never maps half a file. */
+bool Mesh::saveSnapshot(const string& snapshotPath, uint64_t sourceHash) {
+    MeshSnapshotHeader header = {};
+    memcpy(header.magic, snapshotMagic, 8);
+    header.version = snapshotVersion;
+    header.quantized = quantized;
+    header.sourceHash = sourceHash;
+    header.nodeSize = sizeof(BVHNode);
+    header.triangleSize = quantized ? sizeof(QuantizedTriangle) : sizeof(PackedTriangle);
+    header.nodeCount = bvh.nodeCount();
+    header.triangleCount = getTriangleCount();
+    header.nodeOffset = alignUp(sizeof(MeshSnapshotHeader));
+    header.indexOffset = alignUp(header.nodeOffset + header.nodeCount * sizeof(BVHNode));
+    header.triangleOffset = alignUp(header.indexOffset + header.triangleCount * sizeof(int32_t));
+    header.wideNodeSize = sizeof(WideBVHNode);
+    header.wideNodeCount = bvh.wideNodeCount();
+    header.wideNodeOffset = alignUp(header.triangleOffset + header.triangleCount * header.triangleSize);
+    for(int axis = 0; axis < 3; axis++) {
+        header.boundsMin[axis] = boundsMin[axis];
+        header.quantizeScale[axis] = quantizeScale[axis];
+    }
+
+    const char* sections[4] = {(const char*)bvh.nodeData(), (const char*)bvh.indexData(),
+                               quantized ? (const char*)quantizedData() : (const char*)packedData(), (const char*)bvh.wideNodeData()};
+    uint64_t offsets[4] = {header.nodeOffset, header.indexOffset, header.triangleOffset, header.wideNodeOffset};
+    uint64_t sizes[4] = {header.nodeCount * sizeof(BVHNode), header.triangleCount * sizeof(int32_t), header.triangleCount * header.triangleSize,
+                         header.wideNodeCount * sizeof(WideBVHNode)};
+
+    ofDirectory::createDirectory(ofFilePath::getEnclosingDirectory(snapshotPath), false, true);
+    string temporaryPath = temporaryFilePath(snapshotPath);
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        uint64_t written = sizeof(header);
+        const char padding[snapshotAlignment] = {};
+        for(int s = 0; s < 4; s++) {
+            file.write(padding, offsets[s] - written);
+            file.write(sections[s], sizes[s]);
+            written = offsets[s] + sizes[s];
+        }
+        if(!file.good()) {
+            file.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    return std::rename(temporaryPath.c_str(), snapshotPath.c_str()) == 0;
+}
+// Copies mapped triangles back into the vectors so they can be changed, and drops the mapping
+void Mesh::unmap() {
+    if(!snapshot) return;
+    if(quantized) quantizedTriangles.assign(quantizedData(), quantizedData() + mappedTriangleCount);
+    else packedTriangles.assign(packedData(), packedData() + mappedTriangleCount);
+    snapshot.reset();
+    mappedTriangleCount = 0;
+}
+WatertightRay::WatertightRay(const Ray& ray) {
+    origin = ray.position;
+    
+    // Permute axes so z is the largest direction component, and keep the winding when it's negative
+    glm::vec3 absDirection = glm::abs(ray.direction);
+    kz = 0;
+    if(absDirection.y > absDirection[kz]) kz = 1;
+    if(absDirection.z > absDirection[kz]) kz = 2;
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    if(ray.direction[kz] < 0) std::swap(kx, ky);
+    
+    sx = ray.direction[kx] / ray.direction[kz];
+    sy = ray.direction[ky] / ray.direction[kz];
+    sz = 1.0f / ray.direction[kz];
+}
+// Returns true on a hit in front of or behind the origin, distance is signed along the ray.
+bool WatertightRay::intersect(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, float& distance) const {
+    glm::vec3 a = v1 - origin;
+    glm::vec3 b = v2 - origin;
+    glm::vec3 c = v3 - origin;
+    
+    // Shear the vertices into ray space
+    float ax = a[kx] - sx * a[kz];
+    float ay = a[ky] - sy * a[kz];
+    float bx = b[kx] - sx * b[kz];
+    float by = b[ky] - sy * b[kz];
+    float cx = c[kx] - sx * c[kz];
+    float cy = c[ky] - sy * c[kz];
+    
+    // Scaled barycentrics, redone in double precision when the ray grazes an edge
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+    if(u == 0.0f || v == 0.0f || w == 0.0f) {
+        u = (float)((double)cx * (double)by - (double)cy * (double)bx);
+        v = (float)((double)ax * (double)cy - (double)ay * (double)cx);
+        w = (float)((double)bx * (double)ay - (double)by * (double)ax);
+    }
+    if((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) return false;
+    
+    float det = u + v + w;
+    if(det == 0.0f) return false;
+    
+    float t = u * sz * a[kz] + v * sz * b[kz] + w * sz * c[kz];
+    distance = t / det;
+    return true;
 }
 // Similar to above shortest intersection, iterates through every triangle in a mesh to find shortest intersection.
 bool Mesh::intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) {
-    bool hit = false;
-    // These vars will store vertices of triangle closest to ray
-    glm::vec3 v1, v2, v3;
-    glm::vec2 bary;
-    float distance; // Distance to that triangle
+    WatertightRay wray(ray);
+    int closest = -1; // Index of triangle closest to ray
+    float distance;
     float shortest = std::numeric_limits<float>::max();
     
-    for(int i = 0; i < triangles.size(); i++) {
-        if(glm::intersectRayTriangle(ray.position, ray.direction, vertices[triangles[i].v1], vertices[triangles[i].v2], vertices[triangles[i].v3], bary, distance)) {
-            hit = true;
-            if(distance > 0.001f && distance < shortest) {
-                v1 = vertices[triangles[i].v1];
-                v2 = vertices[triangles[i].v2];
-                v3 = vertices[triangles[i].v3];
-                shortest = distance;
+    bvh.traverse(ray, shortest, [&](int i, float& maxDistance) {
+        if(quantized) {
+            const uint16_t* q = quantizedData()[i].v;
+            if(!wray.intersect(dequantize(q), dequantize(q + 3), dequantize(q + 6), distance)) return false;
+        } else {
+            const PackedTriangle& tri = packedData()[i];
+            if(!wray.intersect(tri.v1, tri.v2, tri.v3, distance)) return false;
+        }
+        if(distance > 0.001f && distance < maxDistance) {
+            closest = i;
+            maxDistance = distance;
+        }
+        return false;
+    });
+    if(closest < 0) return false;
+    
+    glm::vec3 v1, v2, v3;
+    getTriangle(closest, v1, v2, v3);
+    Ray r = ray;
+    point = r.evalPoint(shortest);
+    normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
+    return true;
+}
+void Mesh::getTriangle(int i, glm::vec3& v1, glm::vec3& v2, glm::vec3& v3) {
+    if(quantized) {
+        const uint16_t* q = quantizedData()[i].v;
+        v1 = dequantize(q);
+        v2 = dequantize(q + 3);
+        v3 = dequantize(q + 6);
+    } else {
+        const PackedTriangle& tri = packedData()[i];
+        v1 = tri.v1;
+        v2 = tri.v2;
+        v3 = tri.v3;
+    }
+}
+// Flatten the parsed index/vertex lists into the packed (or quantised) triangle list, then free them.
+void Mesh::buildTriangles() {
+    snapshot.reset();
+    mappedTriangleCount = 0;
+    packedTriangles.clear();
+    quantizedTriangles.clear();
+    
+    if(quantized && vertices.size() > 1) {
+        // Index 0 is the placeholder vertex for 1-based OBJ indices, leave it out of the bounds
+        glm::vec3 boundsMax = vertices[1];
+        boundsMin = vertices[1];
+        for(int i = 1; i < vertices.size(); i++) {
+            boundsMin = glm::min(boundsMin, vertices[i]);
+            boundsMax = glm::max(boundsMax, vertices[i]);
+        }
+        quantizeScale = (boundsMax - boundsMin) / 65535.0f;
+        glm::vec3 inverseScale;
+        for(int axis = 0; axis < 3; axis++) {
+            inverseScale[axis] = quantizeScale[axis] > 0 ? 1.0f / quantizeScale[axis] : 0.0f;
+        }
+        
+        quantizedTriangles.reserve(triangles.size());
+        for(Triangle tri : triangles) {
+            int indices[3] = {tri.v1, tri.v2, tri.v3};
+            QuantizedTriangle q;
+            for(int k = 0; k < 3; k++) {
+                glm::vec3 scaled = (vertices[indices[k]] - boundsMin) * inverseScale + 0.5f;
+                for(int axis = 0; axis < 3; axis++) {
+                    q.v[k * 3 + axis] = (uint16_t)glm::clamp(scaled[axis], 0.0f, 65535.0f);
+                }
             }
+            quantizedTriangles.push_back(q);
+        }
+    } else {
+        packedTriangles.reserve(triangles.size());
+        for(Triangle tri : triangles) {
+            packedTriangles.push_back({vertices[tri.v1], vertices[tri.v2], vertices[tri.v3]});
         }
     }
-    if(hit) {
-        Ray r = ray;
-        point = r.evalPoint(shortest);
-        normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
+    
+    vector<glm::vec3>().swap(vertices);
+    vector<Triangle>().swap(triangles);
+    buildBVH();
+}
+// Builds the triangle hierarchy, then moves the triangles into its leaf order so a leaf reads one contiguous run
+void Mesh::buildBVH(BVH::Method method) {
+    unmap();
+    vector<AABB> bounds(getTriangleCount());
+    ThreadPool::shared().parallelFor(bounds.size(), [this, &bounds](int i) {
+        glm::vec3 v1, v2, v3;
+        getTriangle(i, v1, v2, v3);
+        bounds[i].extend(v1);
+        bounds[i].extend(v2);
+        bounds[i].extend(v3);
+    }, 4096);
+    bvh.build(bounds, method);
+    
+    if(quantized) {
+        vector<QuantizedTriangle> ordered(quantizedTriangles.size());
+        for(int i = 0; i < ordered.size(); i++) ordered[i] = quantizedTriangles[bvh.indices[i]];
+        quantizedTriangles.swap(ordered);
+    } else {
+        vector<PackedTriangle> ordered(packedTriangles.size());
+        for(int i = 0; i < ordered.size(); i++) ordered[i] = packedTriangles[bvh.indices[i]];
+        packedTriangles.swap(ordered);
     }
-    return hit;
+    for(int i = 0; i < bvh.indices.size(); i++) bvh.indices[i] = i;
 }
 void Mesh::draw() {
-    for(Triangle tri: triangles) {
-        ofDrawTriangle(vertices[tri.v1], vertices[tri.v2], vertices[tri.v3]);
+    glm::vec3 v1, v2, v3;
+    for(int i = 0; i < getTriangleCount(); i++) {
+        getTriangle(i, v1, v2, v3);
+        ofDrawTriangle(v1, v2, v3);
     }
 }
 void Mesh::parseFile(string filePath) {
@@ -80,6 +338,7 @@ void Mesh::parseFile(string filePath) {
     }
 }
 BaseLight::BaseLight(glm::vec3 position, ofColor diffuse) {
+    if(ofGetCurrentRenderer() == nullptr) return;  // No window (render server), nothing to preview with
     previewLight.setup();
     previewLight.enable();
     previewLight.setDiffuseColor(diffuse);
@@ -92,7 +351,7 @@ PointLight::PointLight(glm::vec3 position, float intensity, ofColor diffuse) : B
     this->intensity = intensity;
     diffuseColor = diffuse;
     isSelectable = true;
-    previewLight.setPointLight();
+    if(ofGetCurrentRenderer() != nullptr) previewLight.setPointLight();
 }
 LightAnchor::LightAnchor(glm::vec3 position) : BaseLight(position, ofColor::white){
     this->position = position;
@@ -123,54 +382,74 @@ void SpotLight::draw() {
 }
 Plane::Plane(glm::vec3 position, glm::vec3 normal, ofColor diffuse, float width, float height, ofImage* diffTex, ofImage* specTex, int tiles) {
     this->position = position;
-    this->normal = normal;
     this->width = width;
     this->height = height;
     diffuseColor = diffuse;
     diffuseTexture = diffTex;
     specularTexture = specTex;
     this->tiles = tiles;
-    
-    plane.lookAt(normal);
+    setFrame(normal);
 }
 Plane::Plane() {}
 
-ofColor Plane::mapPlaneToTexture(glm::vec3 intersection, ofImage* texture) {
-    /* To find the range of width and height, take the original width and height of plane, and divide by tiles
-    to obtain the width and height of a sub tile. */
-    
-    float rangeW = width / tiles;
-    float rangeH = height / tiles;
-    float widthCoord = intersection.x;
-    float heightCoord = intersection.y; // This is because we have hardcoded horizontal and vertical planes.
-    
-    if(normal == glm::vec3(0, 1, 0)) heightCoord = intersection.z; // Use the z instead of y if we have a horizontal plane.
-    if(normal == glm::vec3(-1, 0, 0)) widthCoord = intersection.z;
-    if(normal == glm::vec3(1, 0, 0)) widthCoord = -intersection.z;
-        
-    if(heightCoord < 0) rangeH = -rangeH; // Do this negative b/c of modulus:
-    if(widthCoord < 0) rangeW = -rangeW; // If the intersection point has negative coordinates, adjust mapping range
+// Orthonormal frame around normal. Without a tangent it's horizontal, except on floors and
+// ceilings where it's +x with bitangent +z. That's a mirrored frame on floors, so the quad drawn
+// is turned with bitangent worked out again from the other two
+void Plane::setFrame(glm::vec3 normal, glm::vec3 tangent) {
+    this->normal = glm::normalize(normal);
+    tangent -= this->normal * glm::dot(tangent, this->normal);
+    if(glm::length(tangent) > 1e-6f) {
+        this->tangent = glm::normalize(tangent);
+        bitangent = glm::cross(this->normal, this->tangent);
+    } else if(glm::abs(this->normal.y) > 0.999f) {
+        this->tangent = glm::vec3(1, 0, 0);
+        bitangent = glm::vec3(0, 0, 1);
+    } else {
+        this->tangent = glm::normalize(glm::cross(glm::vec3(0, 1, 0), this->normal));
+        bitangent = glm::cross(this->normal, this->tangent);
+    }
+    inverseHalfSize = glm::vec2(width > 0 ? 2 / width : 0, height > 0 ? 2 / height : 0);
+    textureScale = glm::vec2(width > 0 ? tiles / width : tiles, height > 0 ? tiles / height : tiles);
+    textureOffset = glm::vec2(width > 0 ? tiles / 2.0f : 0, height > 0 ? tiles / 2.0f : 0);
+    plane.setGlobalOrientation(glm::quat_cast(glm::mat3(this->tangent, glm::cross(this->normal, this->tangent), this->normal)));
+}
 
-    // Map the intersection point coordinates to the u, v normalized points.
-    float u = ofMap(fmod(widthCoord, width / tiles), 0, rangeW, 0, 1);
-    float v = ofMap(fmod(heightCoord, width / tiles), 0, rangeH, 0, 1);
+// Where the intersection falls in the plane's texture, both coordinates in [0, 1). The texture
+// is tiles x tiles times over the quad, starting at its (-tangent, -bitangent) corner, and a
+// tile is 1 / tiles of a unit along unbounded sides
+glm::vec2 Plane::textureCoordinates(glm::vec3 intersection) {
+    glm::vec3 d = intersection - position;
+    glm::vec2 uv = glm::vec2(glm::dot(d, tangent), glm::dot(d, bitangent)) * textureScale + textureOffset;
+    return uv - glm::floor(uv);
+}
+ofColor Plane::mapPlaneToTexture(glm::vec3 intersection, ofImage* texture) {
+    glm::vec2 uv = textureCoordinates(intersection);
 
     // Convert (u, v) points to points in the image
-    float i = u * texture->getWidth() - 1;
-    float j = v * texture->getHeight() - 1;
+    float i = uv.x * texture->getWidth() - 1;
+    float j = uv.y * texture->getHeight() - 1;
     
     return texture->getColor(i, j); // Return the mapped pixel's color
 }
+// Colour from the texture cache. The mip level is where a pixel footprint wide covers about one texel
+ofColor Plane::cachedTextureColor(glm::vec3 intersection, int texture, float footprint) {
+    TextureCache& cache = TextureCache::shared();
+    float texelsPerPixel = footprint * cache.getSize(texture).x * textureScale.x;
+    return cache.lookup(texture, textureCoordinates(intersection), texelsPerPixel);
+}
 
-ofColor Plane::getDiffuseColor(glm::vec3 intersection) {
+ofColor Plane::getDiffuseColor(glm::vec3 intersection, float footprint) {
+    if(diffuseTextureId >= 0) return cachedTextureColor(intersection, diffuseTextureId, footprint);
     if(diffuseTexture == nullptr) return diffuseColor;
     return mapPlaneToTexture(intersection, diffuseTexture);
 }
-ofColor Plane::getSpecularColor(glm::vec3 intersection) {
+ofColor Plane::getSpecularColor(glm::vec3 intersection, float footprint) {
+    if(specularTextureId >= 0) return cachedTextureColor(intersection, specularTextureId, footprint);
     if(specularTexture == nullptr) return specularColor;
     return mapPlaneToTexture(intersection, specularTexture);
 }
 void Plane::draw() {
+    if(!isBounded()) return;
     plane.setPosition(position);
     plane.setWidth(width);
     plane.setHeight(height);
@@ -178,37 +457,41 @@ void Plane::draw() {
     plane.draw();
 }
 
-// Intersect Ray with Plane  (wrapper on glm::intersect*)
+// Ray / plane hit, then the hit's offset from the centre in half extents has to be within 1 both ways.
+// A ray parallel to the plane gives an infinite or NaN distance, which fails the comparisons
 bool Plane::intersect(const Ray& ray, glm::vec3& point, glm::vec3& normalAtIntersect) {
-    float dist;
-    bool hit = glm::intersectRayPlane(ray.position, ray.direction, position, normal, dist);
-    if (hit) {
-        // If we find a hit but the distance is negative, then the ray had to travel backwards. No hit.
-        if(dist < 0) hit = false;
-        
-        Ray r = ray;
-        point = r.evalPoint(dist);
-        float half_w = width / 2;
-        float half_h = height / 2;
-        
-        if(normal == glm::vec3(0, 1, 0)) { // Horizontal Plane
-            if(point.x < position.x - half_w || point.x > position.x + half_w || point.z < position.z - half_h || point.z > position.z + half_h) {
-                hit = false;
-            }
-        } else if(normal == glm::vec3(0, 0, 1)) { // Vertical plane facing cam
-            if(point.x < position.x - half_w || point.x > position.x + half_w || point.y < position.y - half_h || point.y > position.y + half_h) {
-                hit = false;
-            }
-        } else { // vertical plane facing sides
-            if(point.z < position.z - half_w || point.z > position.z + half_w || point.y < position.y - half_h || point.y > position.y + half_h) {
-                hit = false;
-            }
-        }
-        
-    }
-    
-    normalAtIntersect = this->normal; // Update normal
-    return (hit);
+    float dist = glm::dot(position - ray.position, normal) / glm::dot(ray.direction, normal);
+    point = ray.position + ray.direction * dist;
+    glm::vec3 d = point - position;
+    glm::vec2 local = glm::abs(glm::vec2(glm::dot(d, tangent), glm::dot(d, bitangent)) * inverseHalfSize);
+    normalAtIntersect = normal;
+    return dist > 0 && dist < std::numeric_limits<float>::max() && local.x <= 1 && local.y <= 1;
+}
+// Corners of the rectangle intersect() accepts, in winding order. Only for bounded planes
+void Plane::getCorners(glm::vec3 corners[4]) {
+    glm::vec3 a = tangent * (width / 2);     // Half extents along the two in-plane axes
+    glm::vec3 b = bitangent * (height / 2);
+    corners[0] = position - a - b;
+    corners[1] = position + a - b;
+    corners[2] = position + a + b;
+    corners[3] = position - a + b;
+}
+// Closest point of the quad to point
+glm::vec3 Plane::nearestPoint(glm::vec3 point) {
+    glm::vec3 d = point - position;
+    float a = glm::dot(d, tangent), b = glm::dot(d, bitangent);
+    if(width > 0) a = std::min(std::max(a, -width / 2), width / 2);
+    if(height > 0) b = std::min(std::max(b, -height / 2), height / 2);
+    return position + tangent * a + bitangent * b;
+}
+// Box around the corners, padded a little so it isn't flat along the normal. Empty when unbounded
+AABB Plane::getBounds() {
+    if(!isBounded()) return AABB();
+    glm::vec3 corners[4];
+    getCorners(corners);
+    AABB box;
+    for(int i = 0; i < 4; i++) box.extend(corners[i]);
+    return AABB(box.min - 0.001f, box.max + 0.001f);
 }
 // Convert (u, v) to (x, y, z)
 // We assume u,v is in [0, 1]
@@ -225,7 +508,25 @@ RenderCam::RenderCam()  {
 // the ViewPlane
 Ray RenderCam::getRay(float u, float v) {
     glm::vec3 pointOnPlane = view.toWorld(u, v);
-    return(Ray(position, glm::normalize(pointOnPlane - position)));
+    return(Ray(position, glm::normalize(toWorldDirection(pointOnPlane - position))));
+}
+// Move the camera, dragging the view plane along so the framing stays the same
+void RenderCam::setPosition(glm::vec3 p) {
+    glm::vec3 offset = p - position;
+    position = p;
+    view.position += offset;
+    view.min += glm::vec2(offset.x, offset.y);
+    view.max += glm::vec2(offset.x, offset.y);
+}
+// The view plane is laid out looking down -z, rotate a direction from that frame to face aim.
+// With the default aim of (0, 0, -1) this is the identity.
+glm::vec3 RenderCam::toWorldDirection(glm::vec3 d) {
+    glm::vec3 forward = glm::normalize(aim);
+    glm::vec3 up = glm::vec3(0, 1, 0);
+    if(glm::abs(glm::dot(forward, up)) > 0.999f) up = glm::vec3(0, 0, 1);
+    glm::vec3 right = glm::normalize(glm::cross(forward, up));
+    up = glm::cross(right, forward);
+    return right * d.x + up * d.y - forward * d.z;
 }
 
 // This could be drawn a lot simpler but I wanted to use the getRay call
@@ -2,32 +2,23 @@
 
 #include "ofMain.h"
 #include "glm/gtx/intersect.hpp"
+#include "Ray.h"
+#include "BVH.h"
+#include "TextureCache.h"
 
 
-//  General Purpose Ray class 
-//
-class Ray {
-public:
-    // Methods
-    //
-	Ray(glm::vec3 position, glm::vec3 direction) { this->position = position; this->direction = direction; }
-	void draw(float time) { ofDrawLine(position, position + time * direction); }
-	glm::vec3 evalPoint(float time) { return (position + time * direction); }
-
-    // Variables
-    //
-	glm::vec3 position, direction;
-};
-
 class BaseLight;
 class SceneObject {
 public:
     // Methods
     //
+    virtual ~SceneObject() {}
     virtual void draw() {}
     virtual bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) { return false; }
-    virtual ofColor getDiffuseColor(glm::vec3 intersection) { return diffuseColor; }
-    virtual ofColor getSpecularColor(glm::vec3 intersection) { return specularColor; }
+    virtual AABB getBounds() { return AABB(); }     // Empty if unknown, the scene hierarchy then tests it for every ray
+    // footprint is the world size of a pixel at the hit, picks texture detail. 0 for the finest
+    virtual ofColor getDiffuseColor(glm::vec3 intersection, float footprint = 0) { return diffuseColor; }
+    virtual ofColor getSpecularColor(glm::vec3 intersection, float footprint = 0) { return specularColor; }
 
     // Variables
     //
@@ -51,6 +42,7 @@ public:
     bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) {
         return (glm::intersectRaySphere(ray.position, ray.direction, position, radius, point, normal));
     }
+    AABB getBounds() { return AABB(position - radius, position + radius); }
     void draw() { ofDrawSphere(position, radius); }
     ofColor getDiffuseColor();
 
@@ -70,21 +62,113 @@ public:
     int v1, v2, v3;
 };
 
+//  Per-ray setup for the watertight ray/triangle test (Woop, Benthin & Wald 2013).
+//  The ray is sheared so it points down +z; each triangle test then only needs a few
+//  multiplies and sign checks, and edges shared by two triangles can never leak a ray.
+//
+class WatertightRay {
+public:
+    // Methods
+    //
+    WatertightRay(const Ray& ray);
+    bool intersect(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, float& distance) const;
+
+    // Variables
+    //
+    glm::vec3 origin;
+    int kx, ky, kz;         // Axis permutation, kz is the dominant ray direction
+    float sx, sy, sz;       // Shear constants
+};
+
+//  Triangle with its vertices copied inline, so a test reads one contiguous record
+//  instead of three scattered entries of the vertex list.
+//
+class PackedTriangle {
+public:
+    glm::vec3 v1, v2, v3;
+};
+
+//  Triangle with vertices quantised to 16 bits per axis over the mesh bounds (18 bytes).
+//  Vertices shared by triangles decode to the exact same floats, so it stays watertight.
+//
+class QuantizedTriangle {
+public:
+    uint16_t v[9];
+};
+
+//  On-disk layout of a mesh snapshot: its flattened triangles and built BVH, ready to trace once
+//  mapped. Offsets are from the file start, so the file can be mapped anywhere.
+//    MeshSnapshotHeader
+//    BVHNode[nodeCount]
+//    int32_t[triangleCount]                               BVH indices
+//    PackedTriangle or QuantizedTriangle[triangleCount]   in the BVH's leaf order
+//    WideBVHNode[wideNodeCount]                           none if the BVH couldn't be widened
+//
+struct MeshSnapshotHeader {
+    char magic[8];              // "RTMESH\0\0"
+    uint32_t version;
+    uint32_t quantized;
+    uint64_t sourceHash;        // Of the OBJ file the snapshot was built from
+    uint32_t nodeSize;          // sizeof(BVHNode) and of the triangle type when written, a snapshot
+    uint32_t triangleSize;      // from a build with a different layout is rejected
+    uint64_t nodeCount;
+    uint64_t triangleCount;
+    uint64_t nodeOffset;
+    uint64_t indexOffset;
+    uint64_t triangleOffset;
+    float boundsMin[3];         // Quantisation frame
+    float quantizeScale[3];
+    uint32_t wideNodeSize;
+    uint32_t wideNodeCount;
+    uint64_t wideNodeOffset;
+};
+
+/*  Triangle mesh from an OBJ file, traced through its own BVH.
+ Parsing and building a big mesh takes a while, so the result is written to a snapshot in
+ snapshotDirectory, keyed by a hash of the OBJ's contents, and mapped straight back. Later loads
+ of the same file map the snapshot and trace from it directly, with nothing parsed, built or copied.
+ Copies of a mapped mesh share the mapping.
+ */
 class Mesh : public SceneObject {
 public:
     // Methods
     //
-    Mesh(glm::vec3 position, ofColor diffuse, string filePath);
+    Mesh(glm::vec3 position, ofColor diffuse, string filePath, bool quantized = false);
+    bool loadSnapshot(const string& snapshotPath, uint64_t sourceHash);
+    bool saveSnapshot(const string& snapshotPath, uint64_t sourceHash);
+    bool isMapped() { return snapshot != nullptr; }
     void draw();
     bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal);
     void addVertice(glm::vec3 vertice) { vertices.push_back(vertice); }
     void addTriangle(int v1, int v2, int v3) { triangles.push_back(Triangle(v1, v2, v3)); }
     void parseFile(string filePath);
+    void buildTriangles();
+    void buildBVH(BVH::Method method = BVH::SAH);
+    AABB getBounds() { return bvh.bounds(); }
+    int getTriangleCount() { return snapshot ? mappedTriangleCount : (quantized ? quantizedTriangles.size() : packedTriangles.size()); }
+    const PackedTriangle* packedData() { return snapshot ? (const PackedTriangle*)(snapshot->getData() + triangleOffset) : packedTriangles.data(); }
+    const QuantizedTriangle* quantizedData() { return snapshot ? (const QuantizedTriangle*)(snapshot->getData() + triangleOffset) : quantizedTriangles.data(); }
+    void getTriangle(int i, glm::vec3& v1, glm::vec3& v2, glm::vec3& v3);
+    glm::vec3 dequantize(const uint16_t* q) { return boundsMin + glm::vec3(q[0], q[1], q[2]) * quantizeScale; }
     
     // Variables
     //
-    vector<glm::vec3> vertices;
+    vector<glm::vec3> vertices;     // Only used while parsing, released by buildTriangles()
     vector<Triangle> triangles;
+    vector<PackedTriangle> packedTriangles;
+    vector<QuantizedTriangle> quantizedTriangles;
+    BVH bvh;                        // Triangles are stored in its leaf order, so its indices are just 0..n-1
+    glm::vec3 boundsMin = glm::vec3(0, 0, 0);
+    glm::vec3 quantizeScale = glm::vec3(0, 0, 0);
+    bool quantized = false;
+    static string snapshotDirectory;    // Empty turns snapshots off
+
+private:
+    void unmap();
+
+    std::shared_ptr<MappedFile> snapshot;   // Set while the triangles and BVH are read from a snapshot
+    size_t triangleOffset = 0;
+    int mappedTriangleCount = 0;
 };
 class BaseLight : public SceneObject {
 public:
@@ -144,24 +228,47 @@ public:
     float angle = 30.0;
     LightAnchor* anchor;
 };
-//  General purpose plane
-//
-//  General purpose plane
+/*  General purpose plane: a width x height quad centred on position, facing any way. Width runs
+ along tangent and height along bitangent. A width or height of 0 leaves the plane unbounded
+ that way.
+ The frame is worked out once by setFrame(), along with the inverse half extents and texture
+ scale, so hits, the inside test and texture coordinates are a few dot products with no
+ branches. By default tangent is horizontal (+x on floors, so the axis aligned floors and walls
+ map textures like they always did); pass one to turn the quad about its normal.
+ Call setFrame() again after changing normal, width, height or tiles.
+ */
 class Plane : public SceneObject {
 public:
     Plane(glm::vec3 position, glm::vec3 normal = glm::vec3(0, 1, 0), ofColor diffuse = ofColor::darkOliveGreen, float width = 20, float height = 20, ofImage* diffTex = nullptr, ofImage* specTex = nullptr, int tiles = 1);
     Plane();
+    void setFrame(glm::vec3 normal, glm::vec3 tangent = glm::vec3(0, 0, 0));
     bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal);
+    bool isBounded() { return width > 0 && height > 0; }
+    void getCorners(glm::vec3 corners[4]);
+    glm::vec3 nearestPoint(glm::vec3 point);
+    AABB getBounds();
+    glm::vec2 textureCoordinates(glm::vec3 intersection);
     ofColor mapPlaneToTexture(glm::vec3 intersection, ofImage* texture);
-    ofColor getDiffuseColor(glm::vec3 intersection);
-    ofColor getSpecularColor(glm::vec3 intersection);
+    ofColor cachedTextureColor(glm::vec3 intersection, int texture, float footprint);
+    void setCachedTextures(int diffuse, int specular) { diffuseTextureId = diffuse; specularTextureId = specular; }
+    ofColor getDiffuseColor(glm::vec3 intersection, float footprint = 0);
+    ofColor getSpecularColor(glm::vec3 intersection, float footprint = 0);
     void draw();
     
     ofPlanePrimitive plane;
     glm::vec3 normal;
+    glm::vec3 tangent = glm::vec3(1, 0, 0);
+    glm::vec3 bitangent = glm::vec3(0, 1, 0);
     float width;
     float height;
     int tiles;
+    int diffuseTextureId = -1;      // TextureCache::shared() handles, used instead of the ofImages when set
+    int specularTextureId = -1;
+
+private:
+    glm::vec2 inverseHalfSize = glm::vec2(0, 0);   // 0 along unbounded sides
+    glm::vec2 textureScale = glm::vec2(1, 1);       // Texture repeats per world unit along tangent and bitangent
+    glm::vec2 textureOffset = glm::vec2(0, 0);      // Moves texture coordinates from the centre to the corner
 };
 // view plane for render camera
 class  ViewPlane : public Plane {
@@ -218,6 +325,9 @@ class RenderCam : public SceneObject {
 public:
     RenderCam();
     Ray getRay(float u, float v);
+    void setPosition(glm::vec3 p);
+    void setAim(glm::vec3 a) { aim = glm::normalize(a); }
+    glm::vec3 toWorldDirection(glm::vec3 d);
     void draw();
     void drawFrustum();
 
@@ -0,0 +1,267 @@
+#include "Rasterizer.h"
+
+// Twice the signed area of (a, b, p). Written as a cross product around p so swapping a and b
+// gives exactly the negated value, which keeps edges shared by two triangles free of cracks.
+static inline float edge(const glm::vec2& a, const glm::vec2& b, float x, float y) {
+    return (a.x - x) * (b.y - y) - (a.y - y) * (b.x - x);
+}
+// Depth tests one triangle against pixels [begin, end) of a row. Coverage and the depth test are
+// folded into selects, and the outputs are restrict parameters, so the loop vectorises.
+static void rasterSpan(const ScreenTriangle& t, float y, int begin, int end, float inverseArea,
+                       float* __restrict depth, int* __restrict objectIds, int* __restrict triangleIds) {
+    const glm::vec2 p0 = t.p0, p1 = t.p1, p2 = t.p2;    // Copied out so nothing in the loop is reloaded through t
+    const float z0 = t.inverseDepth0 * inverseArea, z1 = t.inverseDepth1 * inverseArea, z2 = t.inverseDepth2 * inverseArea;
+    const int object = t.object, triangle = t.triangle;
+    for(int x = begin; x < end; x++) {
+        float e0 = edge(p1, p2, x, y);
+        float e1 = edge(p2, p0, x, y);
+        float e2 = edge(p0, p1, x, y);
+        float z = e0 * z0 + e1 * z1 + e2 * z2;
+        bool closer = (e0 >= 0.0f) & (e1 >= 0.0f) & (e2 >= 0.0f) & (z > depth[x]);
+        depth[x] = closer ? z : depth[x];
+        objectIds[x] = closer ? object : objectIds[x];
+        triangleIds[x] = closer ? triangle : triangleIds[x];
+    }
+}
+// Closest hit among a list of objects, only taking hits closer than shortest. Same rules as shortestIntersection()
+static SceneObject* closestHit(const vector<SceneObject*>& list, const Ray& ray, glm::vec3& point, glm::vec3& normal, float& shortest) {
+    SceneObject* obj = nullptr;
+    for(SceneObject* candidate : list) {
+        glm::vec3 p, n;
+        if(candidate->intersect(ray, p, n)) {
+            float dist = glm::distance(ray.position, p);
+            if(dist > 0.001f && dist < shortest) {
+                point = p;
+                normal = n;
+                shortest = dist;
+                obj = candidate;
+            }
+        }
+    }
+    return obj;
+}
+
+void Rasterizer::rasterize(const vector<SceneObject*>& scene, RenderCam& cam, int width, int imageHeight, ThreadPool& pool, int firstRow, int rowCount) {
+    this->width = width;
+    this->height = rowCount > 0 ? rowCount : imageHeight;
+    this->firstRow = firstRow;
+
+    // Same camera frame getRay() uses
+    cameraPosition = cam.position;
+    right = cam.toWorldDirection(glm::vec3(1, 0, 0));
+    up = cam.toWorldDirection(glm::vec3(0, 1, 0));
+    forward = -cam.toWorldDirection(glm::vec3(0, 0, 1));
+    focal = cam.position.z - cam.view.position.z;
+    pixelScale = glm::vec2(width / cam.view.width(), imageHeight / cam.view.height());
+    pixelOffset = glm::vec2(cam.position.x - cam.view.min.x, cam.position.y - cam.view.min.y);
+    rayOrigin = right * (0.5f / pixelScale.x - pixelOffset.x) + up * (0.5f / pixelScale.y - pixelOffset.y) + forward * focal;
+    rayStepX = right / pixelScale.x;
+    rayStepY = up / pixelScale.y;
+    rayOrigin += rayStepY * float(firstRow);    // Pixel rows are counted from the band's first row
+
+    // Project everything. Mesh triangles are set up in parallel chunks and appended in order
+    objects = scene;
+    tracedObjects.clear();
+    triangles.clear();
+    spheres.clear();
+    for(int i = 0; i < objects.size(); i++) {
+        if(Sphere* sphere = dynamic_cast<Sphere*>(objects[i])) {
+            ScreenSphere s;
+            s.offset = cameraPosition - sphere->position;
+            s.c = glm::dot(s.offset, s.offset) - sphere->radius * sphere->radius;
+            s.object = i;
+            s.x0 = 0; s.y0 = 0; s.x1 = width - 1; s.y1 = height - 1;
+            // Bound it by its projected box, unless the box reaches behind the camera
+            float depth = glm::dot(-s.offset, forward);
+            if(s.c > 0 && depth - sphere->radius * 1.7321f > nearDistance) {
+                glm::vec2 lo = glm::vec2(std::numeric_limits<float>::max());
+                glm::vec2 hi = -lo;
+                for(int corner = 0; corner < 8; corner++) {
+                    glm::vec3 sign = glm::vec3(corner & 1 ? 1 : -1, corner & 2 ? 1 : -1, corner & 4 ? 1 : -1);
+                    glm::vec3 q = sphere->position + sign * sphere->radius - cameraPosition;
+                    float z = glm::dot(q, forward);
+                    glm::vec2 p = (focal * glm::vec2(glm::dot(q, right), glm::dot(q, up)) / z + pixelOffset) * pixelScale - glm::vec2(0.5f, 0.5f + firstRow);
+                    lo = glm::min(lo, p);
+                    hi = glm::max(hi, p);
+                }
+                s.x0 = std::max(0, int(ceil(lo.x)));
+                s.y0 = std::max(0, int(ceil(lo.y)));
+                s.x1 = std::min(width - 1, int(floor(hi.x)));
+                s.y1 = std::min(height - 1, int(floor(hi.y)));
+            }
+            if(s.x0 <= s.x1 && s.y0 <= s.y1) spheres.push_back(s);
+        } else if(Mesh* mesh = dynamic_cast<Mesh*>(objects[i])) {
+            int count = mesh->getTriangleCount();
+            int chunkSize = 4096;
+            int chunks = (count + chunkSize - 1) / chunkSize;
+            vector<vector<ScreenTriangle>> projected(chunks);
+            pool.parallelFor(chunks, [&](int chunk) {
+                int end = std::min(count, (chunk + 1) * chunkSize);
+                for(int t = chunk * chunkSize; t < end; t++) {
+                    glm::vec3 v1, v2, v3;
+                    mesh->getTriangle(t, v1, v2, v3);
+                    projectTriangle(v1, v2, v3, i, t, projected[chunk]);
+                }
+            });
+            for(auto& chunk : projected) triangles.insert(triangles.end(), chunk.begin(), chunk.end());
+        } else if(Plane* plane = dynamic_cast<Plane*>(objects[i]); plane && plane->isBounded()) {
+            glm::vec3 corners[4];
+            plane->getCorners(corners);
+            projectTriangle(corners[0], corners[1], corners[2], i, -1, triangles);
+            projectTriangle(corners[0], corners[2], corners[3], i, -1, triangles);
+        } else {
+            tracedObjects.push_back(objects[i]);
+        }
+    }
+
+    // Bin triangles into tiles. Each chunk of triangles gets its own bins so binning runs in parallel,
+    // and tiles walk the chunks in order so the result doesn't depend on the thread count
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+    int tileCount = tilesX * tilesY;
+    int chunkCount = std::max(1, std::min(pool.size() * 4, int(triangles.size() / 1024)));
+    chunkStart.resize(chunkCount + 1);
+    for(int c = 0; c <= chunkCount; c++) chunkStart[c] = triangles.size() * c / chunkCount;
+    bins.resize(chunkCount * tileCount);
+    pool.parallelFor(chunkCount, [&](int chunk) {
+        for(int tile = 0; tile < tileCount; tile++) bins[chunk * tileCount + tile].clear();
+        for(int t = chunkStart[chunk]; t < chunkStart[chunk + 1]; t++) {
+            const ScreenTriangle& tri = triangles[t];
+            glm::vec2 lo = glm::max(glm::min(glm::min(tri.p0, tri.p1), tri.p2), glm::vec2(0, 0));
+            glm::vec2 hi = glm::min(glm::max(glm::max(tri.p0, tri.p1), tri.p2), glm::vec2(width - 1, height - 1));
+            if(lo.x > hi.x || lo.y > hi.y) continue;
+            int tx0 = int(lo.x) / tileSize, tx1 = int(hi.x) / tileSize;
+            int ty0 = int(lo.y) / tileSize, ty1 = int(hi.y) / tileSize;
+            for(int ty = ty0; ty <= ty1; ty++) {
+                for(int tx = tx0; tx <= tx1; tx++) {
+                    bins[chunk * tileCount + ty * tilesX + tx].push_back(t);
+                }
+            }
+        }
+    });
+
+    inverseDepth.assign(width * height, 0.0f);
+    objectIds.assign(width * height, -1);
+    triangleIds.assign(width * height, -1);
+    pool.parallelFor(tileCount, [this](int tile) { rasterizeTile(tile); });
+}
+// Clip a world space triangle to the near plane, project it and append the result (0 to 2 triangles)
+void Rasterizer::projectTriangle(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, int object, int triangle, vector<ScreenTriangle>& out) {
+    glm::vec3 view[3];      // (right, up, depth)
+    const glm::vec3* world[3] = {&v1, &v2, &v3};
+    for(int k = 0; k < 3; k++) {
+        glm::vec3 q = *world[k] - cameraPosition;
+        view[k] = glm::vec3(glm::dot(q, right), glm::dot(q, up), glm::dot(q, forward));
+    }
+    if(view[0].z < nearDistance && view[1].z < nearDistance && view[2].z < nearDistance) return;
+
+    glm::vec3 polygon[4];
+    int count = 0;
+    for(int k = 0; k < 3; k++) {
+        const glm::vec3& a = view[k];
+        const glm::vec3& b = view[(k + 1) % 3];
+        bool aInside = a.z >= nearDistance;
+        bool bInside = b.z >= nearDistance;
+        if(aInside) polygon[count++] = a;
+        if(aInside != bInside) polygon[count++] = a + (b - a) * ((nearDistance - a.z) / (b.z - a.z));
+    }
+
+    glm::vec2 screen[4];
+    float depth[4];
+    for(int k = 0; k < count; k++) {
+        depth[k] = 1.0f / polygon[k].z;
+        screen[k] = (focal * glm::vec2(polygon[k].x, polygon[k].y) * depth[k] + pixelOffset) * pixelScale - glm::vec2(0.5f, 0.5f + firstRow);
+    }
+    for(int k = 1; k + 1 < count; k++) {
+        ScreenTriangle t = {screen[0], screen[k], screen[k + 1], depth[0], depth[k], depth[k + 1], object, triangle};
+        float area = edge(t.p0, t.p1, t.p2.x, t.p2.y);
+        if(!(fabsf(area) > 0.0f)) continue;     // Degenerate, or NaN from a vertex on the camera
+        if(area < 0) {  // Both windings are drawn, store them all counter clockwise
+            std::swap(t.p1, t.p2);
+            std::swap(t.inverseDepth1, t.inverseDepth2);
+        }
+        out.push_back(t);
+    }
+}
+void Rasterizer::rasterizeTile(int tile) {
+    int tileCount = tilesX * tilesY;
+    int x0 = (tile % tilesX) * tileSize;
+    int y0 = (tile / tilesX) * tileSize;
+    int x1 = std::min(width, x0 + tileSize) - 1;
+    int y1 = std::min(height, y0 + tileSize) - 1;
+
+    for(int chunk = 0; chunk + 1 < chunkStart.size(); chunk++) {
+        for(int t : bins[chunk * tileCount + tile]) {
+            const ScreenTriangle& tri = triangles[t];
+            int bx0 = std::max(x0, int(ceil(std::min(std::min(tri.p0.x, tri.p1.x), tri.p2.x))));
+            int bx1 = std::min(x1, int(floor(std::max(std::max(tri.p0.x, tri.p1.x), tri.p2.x))));
+            int by0 = std::max(y0, int(ceil(std::min(std::min(tri.p0.y, tri.p1.y), tri.p2.y))));
+            int by1 = std::min(y1, int(floor(std::max(std::max(tri.p0.y, tri.p1.y), tri.p2.y))));
+            float inverseArea = 1.0f / edge(tri.p0, tri.p1, tri.p2.x, tri.p2.y);
+            for(int y = by0; y <= by1; y++) {
+                int row = y * width;
+                rasterSpan(tri, y, bx0, bx1 + 1, inverseArea, &inverseDepth[row], &objectIds[row], &triangleIds[row]);
+            }
+        }
+    }
+
+    // Spheres: inside the conic (discriminant >= 0), depth from the near root
+    for(const ScreenSphere& s : spheres) {
+        int bx0 = std::max(x0, s.x0), bx1 = std::min(x1, s.x1);
+        int by0 = std::max(y0, s.y0), by1 = std::min(y1, s.y1);
+        for(int y = by0; y <= by1; y++) {
+            for(int x = bx0; x <= bx1; x++) {
+                glm::vec3 d = rayOrigin + float(x) * rayStepX + float(y) * rayStepY;
+                float a = glm::dot(d, d);
+                float b = glm::dot(d, s.offset);
+                float discriminant = b * b - a * s.c;
+                if(discriminant < 0) continue;
+                float root = sqrt(discriminant);
+                float t = (-b - root) / a;
+                if(t <= 0) t = (-b + root) / a;     // Camera inside the sphere
+                if(t <= 0) continue;
+                float z = 1.0f / (t * focal);       // The forward component of d is focal
+                int i = y * width + x;
+                if(z > inverseDepth[i]) {
+                    inverseDepth[i] = z;
+                    objectIds[i] = s.object;
+                    triangleIds[i] = -1;
+                }
+            }
+        }
+    }
+}
+// Exact primary hit through the centre of pixel (u, v), ray being that pixel's camera ray
+SceneObject* Rasterizer::resolve(int u, int v, const Ray& ray, glm::vec3& point, glm::vec3& normal) {
+    int i = (v - firstRow) * width + u;
+    float shortest = std::numeric_limits<float>::max();
+    SceneObject* obj = nullptr;
+
+    if(objectIds[i] >= 0) {
+        obj = objects[objectIds[i]];
+        bool hit = false;
+        if(triangleIds[i] >= 0) {
+            glm::vec3 v1, v2, v3;
+            static_cast<Mesh*>(obj)->getTriangle(triangleIds[i], v1, v2, v3);
+            float distance;
+            if(WatertightRay(ray).intersect(v1, v2, v3, distance) && distance > 0.001f) {
+                point = ray.position + ray.direction * distance;
+                normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
+                shortest = distance;
+                hit = true;
+            }
+        } else {
+            glm::vec3 p, n;
+            if(obj->intersect(ray, p, n) && glm::distance(ray.position, p) > 0.001f) {
+                point = p;
+                normal = n;
+                shortest = glm::distance(ray.position, p);
+                hit = true;
+            }
+        }
+        // The pixel centre sits right on the primitive's edge and the ray slipped past, search everything
+        if(!hit) return closestHit(objects, ray, point, normal, shortest);
+    }
+    SceneObject* traced = closestHit(tracedObjects, ray, point, normal, shortest);
+    return traced ? traced : obj;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "ThreadPool.h"
+
+//  A triangle projected to pixel coordinates, with 1 / view depth at each corner
+//
+struct ScreenTriangle {
+    glm::vec2 p0, p1, p2;
+    float inverseDepth0, inverseDepth1, inverseDepth2;
+    int object;             // Index into the scene
+    int triangle;           // Mesh triangle index, -1 for plane quads
+};
+//  A sphere seen from the camera. The pixels it covers are the inside of a conic in pixel
+//  coordinates, found per pixel from the discriminant of the camera ray / sphere quadratic.
+//
+struct ScreenSphere {
+    glm::vec3 offset;       // Camera position - sphere centre
+    float c;                // |offset|^2 - radius^2
+    int object;
+    int x0, y0, x1, y1;     // Pixel bounds, inclusive
+};
+
+/*  CPU rasteriser for primary visibility ("visibility buffer").
+ Every camera ray starts at the render cam, so the first hit through each pixel centre is what a
+ rasteriser computes. Spheres, planes and mesh triangles are projected once per frame, binned into
+ tiles, and the tiles are filled in parallel with a depth test on 1 / view depth. Each pixel ends
+ up with the object (and triangle) in front. resolve() turns that into the exact hit with a single
+ ray / primitive test, so only shadows and reflections have to search the scene.
+ Objects it can't project (anything but spheres, planes and meshes) are traced at resolve time.
+ It can cover just a band of the image's rows (bottom up, like the view plane) for streamed renders.
+ */
+class Rasterizer {
+public:
+    // Methods
+    //
+    void rasterize(const vector<SceneObject*>& scene, RenderCam& cam, int width, int imageHeight, ThreadPool& pool, int firstRow = 0, int rowCount = 0);
+    SceneObject* resolve(int u, int v, const Ray& ray, glm::vec3& point, glm::vec3& normal);
+
+    // Variables
+    //
+    int tileSize = 32;
+    float nearDistance = 0.001f;    // Same cutoff the ray tracer uses for hits
+
+private:
+    void projectTriangle(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, int object, int triangle, vector<ScreenTriangle>& out);
+    void rasterizeTile(int tile);
+
+    // Camera, as set up for the current frame
+    int width, height;              // Of the band being drawn
+    int firstRow;
+    glm::vec3 cameraPosition, right, up, forward;
+    float focal;                    // Distance from the camera to the view plane
+    glm::vec2 pixelScale;           // Pixels per view plane unit
+    glm::vec2 pixelOffset;          // Camera xy relative to the view plane's corner, in view plane units
+    glm::vec3 rayOrigin, rayStepX, rayStepY;   // Unnormalised camera ray through pixel (x, y) is origin + x stepX + y stepY
+
+    vector<SceneObject*> objects;
+    vector<SceneObject*> tracedObjects;
+    vector<ScreenTriangle> triangles;
+    vector<ScreenSphere> spheres;
+    vector<int> chunkStart;         // Triangles are binned in chunks, one bin list per chunk and tile
+    vector<vector<int>> bins;
+    int tilesX, tilesY;
+
+    // Visibility buffer, rows bottom to top like the view plane
+    vector<float> inverseDepth;     // 0 where nothing was drawn
+    vector<int> objectIds;
+    vector<int> triangleIds;
+};
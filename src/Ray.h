@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ofMain.h"
+
+
+//  General Purpose Ray class 
+//
+class Ray {
+public:
+    // Methods
+    //
+	Ray(glm::vec3 position, glm::vec3 direction) { this->position = position; this->direction = direction; }
+	void draw(float time) { ofDrawLine(position, position + time * direction); }
+	glm::vec3 evalPoint(float time) { return (position + time * direction); }
+
+    // Variables
+    //
+	glm::vec3 position, direction;
+};
+
+//  Axis aligned bounding box, starts out empty
+//
+class AABB {
+public:
+    // Methods
+    //
+    AABB() { min = glm::vec3(std::numeric_limits<float>::max()); max = glm::vec3(-std::numeric_limits<float>::max()); }
+    AABB(glm::vec3 min, glm::vec3 max) { this->min = min; this->max = max; }
+    void extend(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+    void extend(const AABB& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+    bool isEmpty() const { return min.x > max.x; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return max - min; }
+    float surfaceArea() const {
+        glm::vec3 e = glm::max(max - min, glm::vec3(0));
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+    // Slab test, entry is the distance where the ray enters the box (0 if it starts inside)
+    bool intersect(const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& entry) const {
+        glm::vec3 t0 = (min - origin) * inverseDirection;
+        glm::vec3 t1 = (max - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        return entry <= exit;
+    }
+
+    // Variables
+    //
+    glm::vec3 min, max;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Float frame buffer the renderer writes into before anything is quantised into an image.
+//  Besides the colour it keeps the primary hit's features (normal, depth, albedo, object),
+//  which post passes like the denoiser use to find edges. Rows are stored top to bottom,
+//  the same as ofPixels. A buffer can also hold just a band of rows of a taller image,
+//  which is how streamed renders keep memory bounded.
+//
+class RenderBuffer {
+public:
+    // Methods
+    //
+    void allocate(int width, int height, int imageHeight = 0, int firstRow = 0) {
+        this->width = width;
+        this->height = height;
+        this->imageHeight = imageHeight > 0 ? imageHeight : height;
+        this->firstRow = firstRow;
+        int size = width * height;
+        color.assign(size, glm::vec3(0, 0, 0));
+        variance.assign(size, 0.0f);
+        albedo.assign(size, glm::vec3(0, 0, 0));
+        normal.assign(size, glm::vec3(0, 0, 0));
+        depth.assign(size, std::numeric_limits<float>::max());
+        objectId.assign(size, -1);
+    }
+    // Back to what allocate() leaves, before a pixel is traced again
+    void clearPixel(int i) {
+        color[i] = glm::vec3(0, 0, 0);
+        variance[i] = 0.0f;
+        albedo[i] = glm::vec3(0, 0, 0);
+        normal[i] = glm::vec3(0, 0, 0);
+        depth[i] = std::numeric_limits<float>::max();
+        objectId[i] = -1;
+    }
+    int index(int x, int y) const { return y * width + x; }
+    int viewRow(int y) const { return imageHeight - 1 - (firstRow + y); }   // Buffer row to view plane v (bottom up)
+    void toPixels(ofPixels& pixels) const {
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                glm::vec3 c = glm::clamp(color[index(x, y)], 0.0f, 255.0f);
+                pixels.setColor(x, y, ofColor(c.x, c.y, c.z));
+            }
+        }
+    }
+
+    // Variables
+    //
+    int width = 0;
+    int height = 0;
+    int imageHeight = 0;        // Height of the whole image
+    int firstRow = 0;           // Image row of the buffer's first row
+    vector<glm::vec3> color;    // 0 - 255 per channel, averaged over the pixel's samples
+    vector<float> variance;     // Variance of the samples' luminance
+    vector<glm::vec3> albedo;   // Diffuse colour at the primary hit, 0 - 1
+    vector<glm::vec3> normal;
+    vector<float> depth;        // Distance to the primary hit
+    vector<int> objectId;       // Index into the scene, -1 where nothing was hit
+};
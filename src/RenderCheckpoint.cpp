@@ -0,0 +1,114 @@
+#include "RenderCheckpoint.h"
+
+static const char checkpointMagic[8] = {'R', 'T', 'C', 'H', 'K', 'P', 'T', 0};
+static const uint32_t checkpointVersion = 1;
+
+// Row y of buffer as it's laid out in the file, and back
+static void packRow(const RenderBuffer& buffer, int y, char* out) {
+    int i = buffer.index(0, y), w = buffer.width;
+    out = std::copy_n((const char*)&buffer.color[i], w * sizeof(glm::vec3), out);
+    out = std::copy_n((const char*)&buffer.variance[i], w * sizeof(float), out);
+    out = std::copy_n((const char*)&buffer.albedo[i], w * sizeof(glm::vec3), out);
+    out = std::copy_n((const char*)&buffer.normal[i], w * sizeof(glm::vec3), out);
+    out = std::copy_n((const char*)&buffer.depth[i], w * sizeof(float), out);
+    std::copy_n((const char*)&buffer.objectId[i], w * sizeof(int), out);
+}
+static void unpackRow(RenderBuffer& buffer, int y, const char* in) {
+    int i = buffer.index(0, y), w = buffer.width;
+    auto plane = [&in, w](auto* values) {
+        memcpy(values, in, w * sizeof(*values));
+        in += w * sizeof(*values);
+    };
+    plane(&buffer.color[i]);
+    plane(&buffer.variance[i]);
+    plane(&buffer.albedo[i]);
+    plane(&buffer.normal[i]);
+    plane(&buffer.depth[i]);
+    plane(&buffer.objectId[i]);
+}
+
+// Picks up a matching checkpoint at filePath, or starts a new one there. The buffer has to be
+// allocated at the render's size already
+int RenderCheckpoint::open(const string& filePath, uint64_t frameHash, RenderBuffer& buffer) {
+    close();
+    path = ofToDataPath(filePath);
+    width = buffer.width;
+    height = buffer.height;
+    rowsSaved = 0;
+    lastSave = ofGetElapsedTimeMillis();
+    static_assert(sizeof(glm::vec3) * 3 + sizeof(float) * 2 + sizeof(int) == 48, "checkpoint rows assume packed vec3s");
+
+    file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    CheckpointHeader header;
+    if(file.is_open() && file.read((char*)&header, sizeof(header)) && memcmp(header.magic, checkpointMagic, 8) == 0 &&
+       header.version == checkpointVersion && header.width == width && header.height == height &&
+       header.frameHash == frameHash && header.rowsDone <= height) {
+        vector<char> row(rowBytes());
+        int rows = 0;
+        for(; rows < header.rowsDone && file.read(row.data(), row.size()); rows++) {
+            unpackRow(buffer, rows, row.data());
+        }
+        rowsSaved = rows;
+        file.clear();
+        return rowsSaved;
+    }
+
+    // Nothing to resume, start over
+    file.close();
+    file.open(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+    if(!file.is_open()) {
+        cout << "Could not write checkpoint " << path << endl;
+        return 0;
+    }
+    header = {};
+    memcpy(header.magic, checkpointMagic, 8);
+    header.version = checkpointVersion;
+    header.width = width;
+    header.height = height;
+    header.frameHash = frameHash;
+    file.write((const char*)&header, sizeof(header));
+    file.flush();
+    return 0;
+}
+// Call after each finished strip, rows [0, rowsDone) have to be traced
+void RenderCheckpoint::update(const RenderBuffer& buffer, int rowsDone) {
+    if(!file.is_open() || rowsDone <= rowsSaved) return;
+    if(writing.valid() && writing.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+    if(ofGetElapsedTimeMillis() - lastSave < interval * 1000) return;
+    write(buffer, rowsDone);
+}
+// Write everything up to rowsDone now and wait for it, for a cancelled render
+void RenderCheckpoint::save(const RenderBuffer& buffer, int rowsDone) {
+    if(!file.is_open()) return;
+    if(writing.valid()) writing.get();
+    if(rowsDone > rowsSaved) write(buffer, rowsDone);
+    if(writing.valid()) writing.get();
+}
+void RenderCheckpoint::write(const RenderBuffer& buffer, int rowsDone) {
+    if(writing.valid()) writing.get();
+    int first = rowsSaved;
+    int count = rowsDone - first;
+    staging.resize(rowBytes() * count);
+    for(int y = 0; y < count; y++) {
+        packRow(buffer, first + y, &staging[rowBytes() * y]);
+    }
+    rowsSaved = rowsDone;
+    lastSave = ofGetElapsedTimeMillis();
+    writing = std::async(std::launch::async, [this, first, rowsDone] {
+        file.seekp(sizeof(CheckpointHeader) + rowBytes() * first);
+        file.write(staging.data(), staging.size());
+        file.flush();
+        uint32_t done = rowsDone;
+        file.seekp(offsetof(CheckpointHeader, rowsDone));
+        file.write((const char*)&done, sizeof(done));
+        file.flush();
+    });
+}
+void RenderCheckpoint::finish() {
+    close();
+    if(!path.empty()) std::remove(path.c_str());
+}
+void RenderCheckpoint::close() {
+    if(writing.valid()) writing.get();
+    if(file.is_open()) file.close();
+}
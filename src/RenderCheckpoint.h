@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ofMain.h"
+#include "RenderBuffer.h"
+
+//  On-disk layout of a render checkpoint, offsets are from the file start:
+//    CheckpointHeader
+//    rows, top to bottom, each the row's colour, variance, albedo, normal, depth and object
+//    id arrays back to back (48 bytes a pixel). Only the first rowsDone are valid.
+//
+struct CheckpointHeader {
+    char magic[8];              // "RTCHKPT\0"
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowsDone;
+    uint64_t frameHash;         // Scene, camera and settings the rows were traced with
+};
+
+/*  Saves the traced rows of a long render now and then, so a crash or a preempted job resumes
+ where it left off instead of starting over. Rows are saved as the tracer leaves them, before
+ the post passes, and those run over the whole frame once it's done.
+ update() is cheap to call after every strip: at most every interval seconds it copies the rows
+ finished since the last save and writes them on another thread, and if the last write hasn't
+ finished yet it just waits for the next call. The header's row count is only bumped after the
+ rows themselves are written, so a checkpoint killed mid write is still good up to the old count.
+ A checkpoint is only picked up by a render with the same frame hash and size.
+ */
+class RenderCheckpoint {
+public:
+    // Methods
+    //
+    ~RenderCheckpoint() { close(); }
+    int open(const string& filePath, uint64_t frameHash, RenderBuffer& buffer);    // Rows restored into buffer
+    void update(const RenderBuffer& buffer, int rowsDone);
+    void save(const RenderBuffer& buffer, int rowsDone);
+    void finish();          // Render complete, the checkpoint is deleted
+    void close();           // Waits for the last write, keeps the file
+    bool isOpen() { return file.is_open(); }
+
+    // Variables
+    //
+    float interval = 60;    // Seconds between saves
+    int rowsSaved = 0;
+
+private:
+    size_t rowBytes() const { return size_t(width) * 48; }
+    void write(const RenderBuffer& buffer, int rowsDone);
+
+    string path;
+    std::fstream file;
+    int width = 0;
+    int height = 0;
+    uint64_t lastSave = 0;
+    vector<char> staging;               // Rows being written
+    std::future<void> writing;
+};
@@ -0,0 +1,263 @@
+#include "RenderServer.h"
+#include "ofApp.h"
+#include <filesystem>
+
+static vector<string> splitWords(const string& line) {
+    stringstream stream(line);
+    vector<string> words;
+    string s;
+    while(stream >> s) words.push_back(s);
+    return words;
+}
+static glm::vec3 parseVec3(const vector<string>& words, int first) {
+    return glm::vec3(std::stof(words[first]), std::stof(words[first + 1]), std::stof(words[first + 2]));
+}
+static ofColor parseColor(const vector<string>& words, int first) {
+    return ofColor(std::stoi(words[first]), std::stoi(words[first + 1]), std::stoi(words[first + 2]));
+}
+
+RenderServer::RenderServer(ofApp& app) : app(app) {
+    app.parameterSetup();
+    app.updateParameters();
+}
+RenderServer::~RenderServer() {
+    // The app deletes whatever is in its scene, and all of that belongs to the caches here
+    app.scene.clear();
+    app.sceneLights.clear();
+    app.selected.clear();
+    for(auto& scene : scenes) freeScene(scene.second);
+    for(auto& mesh : meshes) delete mesh.second;
+}
+void RenderServer::run(istream& input, ostream& output) {
+    // Parameters a job can set, by the name used in the request. Numbers are clamped to the slider's range
+    auto number = [](ofParameter<float>& parameter) {
+        return [&parameter](const string& value) { parameter = ofClamp(std::stof(value), parameter.getMin(), parameter.getMax()); };
+    };
+    auto integer = [](ofParameter<int>& parameter) {
+        return [&parameter](const string& value) { parameter = ofClamp(std::stoi(value), parameter.getMin(), parameter.getMax()); };
+    };
+    auto toggle = [](ofParameter<bool>& parameter) {
+        return [&parameter](const string& value) { parameter = value == "1" || value == "true" || value == "on"; };
+    };
+    map<string, std::function<void(const string&)>> parameters = {
+        {"spp", integer(app.samplesPerPixelSlider)}, {"bounces", integer(app.lightBounceSlider)}, {"shadows", integer(app.shadowSamplesSlider)},
+        {"ambient", number(app.ambientLightSlider)}, {"diffuse", number(app.diffuseCoefficientSlider)}, {"specular", number(app.specularCoefficientSlider)},
+        {"phong", integer(app.phongPowerSlider)}, {"denoise", toggle(app.denoiseToggle)}, {"wavefront", toggle(app.wavefrontToggle)},
+        {"sortrays", toggle(app.sortRaysToggle)}, {"raster", toggle(app.rasterToggle)},
+        {"lbvh", toggle(app.lbvhToggle)}, {"outline", integer(app.outlineThicknessSlider)},
+        {"reproject", toggle(app.reprojectToggle)}, {"shadowmaps", toggle(app.shadowMapToggle)},
+        {"shadowmapsize", integer(app.shadowMapSizeSlider)}, {"checkpoint", toggle(app.checkpointToggle)},
+        {"lightcutoff", number(app.lightCutoffSlider)}
+    };
+    string line;
+    while(std::getline(input, line)) {
+        vector<string> words = splitWords(line);
+        if(words.empty() || words[0][0] == '#') continue;
+        try {
+            if(words[0] == "quit") {
+                break;
+            } else if(words[0] == "scene" && words.size() >= 2) {
+                if(!loadScene(words[1])) output << "error could not load scene " << words[1] << endl;
+            } else if(words[0] == "camera" && words.size() >= 7) {
+                app.renderCam.setPosition(parseVec3(words, 1));
+                app.renderCam.setAim(parseVec3(words, 4));
+            } else if(words[0] == "view" && words.size() >= 2 && words[1] == "clear") {
+                views.clear();
+            } else if(words[0] == "view" && words.size() >= 9 && (words[1] == "perspective" || words[1] == "orthographic")) {
+                float aspect = float(width) / height;
+                if(words[1] == "perspective") views.push_back(ViewCamera::perspective(parseVec3(words, 2), parseVec3(words, 5), std::stof(words[8]), aspect));
+                else views.push_back(ViewCamera::orthographic(parseVec3(words, 2), parseVec3(words, 5), std::stof(words[8]), aspect));
+            } else if(words[0] == "size" && words.size() >= 3) {
+                width = std::max(1, std::stoi(words[1]));
+                height = std::max(1, std::stoi(words[2]));
+            } else if(words[0] == "set" && words.size() >= 3 && parameters.count(words[1])) {
+                parameters[words[1]](words[2]);
+                app.updateParameters();
+            } else if(words[0] == "output" && words.size() >= 2) {
+                outputPath = words[1];
+            } else if(words[0] == "render") {
+                string message;
+                rendering = true;
+                bool ok = render(message);
+                rendering = false;
+                output << (ok ? "ok " : "error ") << message << endl;
+                if(app.cancelRender) break;     // Asked to stop (SIGTERM), the checkpoint has what was done
+            } else {
+                output << "error unknown request: " << line << endl;
+            }
+        } catch(std::exception& e) {    // stoi / stof on a malformed number
+            output << "error bad request: " << line << endl;
+        }
+    }
+}
+bool RenderServer::render(string& message) {
+    if(scenes.empty()) {
+        message = "no scene loaded";
+        return false;
+    }
+    uint64_t start = ofGetElapsedTimeMillis();
+    bool saved;
+    if(!views.empty()) {
+        vector<ofPixels> images(views.size());
+        for(auto& pixels : images) pixels.allocate(width, height, OF_IMAGE_COLOR);
+        saved = app.multiView.render(views, images);
+        string extension = ofFilePath::getFileExt(outputPath);
+        string base = outputPath.substr(0, outputPath.size() - extension.size() - (extension.empty() ? 0 : 1));
+        for(int i = 0; i < images.size() && saved; i++) {
+            saved = ofSaveImage(images[i], base + "_" + ofToString(i) + "." + (extension.empty() || extension == "ppm" ? "png" : extension));
+        }
+    } else if(ofFilePath::getFileExt(outputPath) == "ppm") {
+        saved = app.renderStreaming(outputPath, width, height);
+    } else {
+        ofPixels pixels;
+        pixels.allocate(width, height, OF_IMAGE_COLOR);
+        app.checkpointPath = outputPath + ".checkpoint";
+        app.rayTrace(pixels);
+        if(app.cancelRender) {
+            message = "cancelled, resume with the same job";
+            return false;
+        }
+        saved = ofSaveImage(pixels, outputPath);
+    }
+    if(app.cancelRender) {
+        message = app.checkpointRenders ? "cancelled, resume with the same job" : "cancelled";
+        return false;
+    }
+    message = saved ? outputPath + " " + ofToString(ofGetElapsedTimeMillis() - start) : "could not write " + outputPath;
+    return saved;
+}
+/* Make the scene in filePath the app's scene. One object or light per line:
+   sphere x y z radius r g b [reflectivity] [cel]
+   plane x y z nx ny nz r g b width height [diffuseTexture specularTexture tiles] [tx ty tz]
+                                    width or height 0 for unbounded, tangent is the width direction
+   mesh x y z r g b file.obj [quantized]
+   particles file r g b             particle dump, see ParticleSet
+   pointlight x y z intensity [r g b]
+ The scene is keyed by the hash of its text and of every file it uses, so an edited texture or
+ mesh is picked up even if the scene file itself didn't change.
+ */
+bool RenderServer::loadScene(const string& filePath) {
+    ofFile file;
+    if(!file.open(ofToDataPath(filePath), ofFile::ReadOnly)) return false;
+    string text = file.readToBuffer().getText();
+    vector<vector<string>> lines;
+    uint64_t key = hashString(text);
+    for(auto& line : ofSplitString(text, "\n")) {
+        vector<string> words = splitWords(line);
+        if(words.empty() || words[0][0] == '#') continue;
+        if(words[0] == "plane" && words.size() >= 16) {
+            key = hashCombine(key, fileHash(words[14]));
+            key = hashCombine(key, fileHash(words[15]));
+        } else if(words[0] == "mesh" && words.size() >= 8) {
+            key = hashCombine(key, fileHash(words[7]));
+        } else if(words[0] == "particles" && words.size() >= 2) {
+            key = hashCombine(key, fileHash(words[1]));
+        }
+        lines.push_back(words);
+    }
+
+    auto cached = scenes.find(key);
+    if(cached == scenes.end()) {
+        CachedScene scene;
+        for(auto& words : lines) {
+            if(words[0] == "sphere" && words.size() >= 8) {
+                float reflectivity = words.size() >= 9 ? std::stof(words[8]) : 0.5f;
+                bool cel = words.size() >= 10 && words[9] == "cel";
+                scene.objects.push_back(new Sphere(parseVec3(words, 1), std::stof(words[4]), parseColor(words, 5), reflectivity, cel));
+            } else if(words[0] == "plane" && words.size() >= 12) {
+                int tiles = words.size() >= 17 ? std::stoi(words[16]) : 1;
+                Plane* plane = new Plane(parseVec3(words, 1), parseVec3(words, 4), parseColor(words, 7),
+                                         std::stof(words[10]), std::stof(words[11]), nullptr, nullptr, tiles);
+                if(words.size() >= 20) plane->setFrame(plane->normal, parseVec3(words, 17));
+                if(words.size() >= 16) plane->setCachedTextures(loadTexture(words[14]), loadTexture(words[15]));
+                scene.objects.push_back(plane);
+            } else if(words[0] == "mesh" && words.size() >= 8) {
+                Mesh* prototype = loadMesh(words[7], words.size() >= 9 && words[8] == "quantized");
+                if(prototype == nullptr) continue;
+                Mesh* mesh = new Mesh(*prototype);
+                mesh->position = parseVec3(words, 1);
+                mesh->diffuseColor = parseColor(words, 4);
+                scene.objects.push_back(mesh);
+            } else if(words[0] == "particles" && words.size() >= 2) {
+                ofColor color = words.size() >= 5 ? parseColor(words, 2) : ofColor::lightGray;
+                ParticleSet* particles = new ParticleSet(words[1], color);
+                if(particles->size() == 0) {
+                    delete particles;
+                    continue;
+                }
+                scene.objects.push_back(particles);
+            } else if(words[0] == "pointlight" && words.size() >= 5) {
+                ofColor color = words.size() >= 8 ? parseColor(words, 5) : ofColor::white;
+                scene.lights.push_back(new PointLight(parseVec3(words, 1), std::stof(words[4]), color));
+            } else {
+                cout << "Skipping scene line: " << words[0] << endl;
+            }
+        }
+        // Make room by dropping the scene that went unused longest, never the one on screen
+        while(scenes.size() >= maxScenes) {
+            auto oldest = scenes.end();
+            for(auto it = scenes.begin(); it != scenes.end(); it++) {
+                if(it->first != currentScene && (oldest == scenes.end() || it->second.lastUsed < oldest->second.lastUsed)) oldest = it;
+            }
+            if(oldest == scenes.end()) break;
+            freeScene(oldest->second);
+            scenes.erase(oldest);
+        }
+        cached = scenes.insert(make_pair(key, scene)).first;
+    }
+
+    cached->second.lastUsed = ++jobCount;
+    currentScene = key;
+    app.sceneContent = key;
+    app.selected.clear();
+    app.scene = cached->second.objects;
+    app.sceneLights = cached->second.lights;
+    return true;
+}
+// Content hash of a file, only read again when its modification time or size changes. 0 if it can't be read
+uint64_t RenderServer::fileHash(const string& filePath) {
+    string path = ofToDataPath(filePath);
+    std::error_code error;
+    int64_t time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    uintmax_t size = std::filesystem::file_size(path, error);
+    if(error) return 0;
+
+    FileHash& entry = fileHashes[path];
+    if(entry.hash == 0 || entry.time != time || entry.size != size) {
+        ofFile file;
+        if(!file.open(path, ofFile::ReadOnly, true)) return 0;
+        ofBuffer buffer = file.readToBuffer();
+        entry.hash = hashBytes(buffer.getData(), buffer.size());
+        entry.time = time;
+        entry.size = size;
+    }
+    return entry.hash;
+}
+// Texture cache handle, -1 if the file can't be read. Only new or changed files are looked at again
+int RenderServer::loadTexture(const string& filePath) {
+    uint64_t hash = fileHash(filePath);
+    if(hash == 0) return -1;
+    auto it = textures.find(hash);
+    if(it != textures.end()) return it->second;
+    
+    int texture = TextureCache::shared().add(filePath);
+    if(texture >= 0) textures[hash] = texture;
+    return texture;
+}
+Mesh* RenderServer::loadMesh(const string& filePath, bool quantized) {
+    uint64_t hash = fileHash(filePath);
+    if(hash == 0) return nullptr;
+    hash = hashCombine(hash, quantized);
+    auto it = meshes.find(hash);
+    if(it != meshes.end()) return it->second;
+
+    Mesh* mesh = new Mesh(glm::vec3(0, 0, 0), ofColor::gray, filePath, quantized);
+    meshes[hash] = mesh;
+    return mesh;
+}
+void RenderServer::freeScene(CachedScene& scene) {
+    for(auto obj : scene.objects) delete obj;
+    for(auto light : scene.lights) delete light;
+    scene.objects.clear();
+    scene.lights.clear();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "ContentHash.h"
+#include "MultiViewRenderer.h"
+
+class ofApp;
+
+/*  Long running render process that takes jobs on an input stream (stdin by default).
+ Jobs are blocks of lines, settings stick from one job to the next:
+   scene <file>                     scene to render, see loadScene() for the format
+   camera px py pz ax ay az         render cam position and aim
+   view perspective px py pz tx ty tz <fov>
+   view orthographic px py pz tx ty tz <height>
+                                    adds a camera looking from p at t, with any views the job renders
+                                    them all in one pass to <output>_0, <output>_1 ... instead of the
+                                    render cam
+   view clear
+   size <width> <height>
+   set <name> <value>               render parameter: spp, bounces, shadows, ambient, diffuse,
+                                    specular, phong, denoise, wavefront, sortrays, raster, lbvh, outline,
+                                    reproject, shadowmaps, shadowmapsize, checkpoint
+   output <file>                    .ppm is streamed in bands, anything else goes through ofSaveImage
+   render                           run the job, answers "ok <file> <ms>" or "error <why>"
+                                    with checkpoint on, progress goes to <output>.checkpoint (a .ppm
+                                    keeps its rows so far and <output>.progress) and the same job
+                                    run again after a crash resumes from it
+   quit
+ Parsed scenes and meshes stay in memory between jobs, keyed by content hash, so a job that only
+ moves the camera or changes a parameter goes straight to tracing. Textures live in the shared
+ texture cache, which keeps only the tiles recent jobs used resident.
+ */
+class RenderServer {
+public:
+    // Methods
+    //
+    RenderServer(ofApp& app);
+    ~RenderServer();
+    void run(istream& input = std::cin, ostream& output = std::cout);
+    bool loadScene(const string& filePath);
+    bool isRendering() const { return rendering; }      // Safe from a signal handler
+
+    // Variables
+    //
+    int maxScenes = 8;              // Parsed scenes kept around, least recently used goes first
+
+private:
+    struct CachedScene {
+        vector<SceneObject*> objects;
+        vector<BaseLight*> lights;
+        int lastUsed = 0;
+    };
+    struct FileHash {
+        int64_t time = 0;
+        uintmax_t size = 0;
+        uint64_t hash = 0;
+    };
+    bool render(string& message);
+    uint64_t fileHash(const string& filePath);
+    int loadTexture(const string& filePath);
+    Mesh* loadMesh(const string& filePath, bool quantized);
+    void freeScene(CachedScene& scene);
+
+    ofApp& app;
+    map<uint64_t, CachedScene> scenes;
+    map<uint64_t, int> textures;            // File hash -> texture cache handle
+    map<uint64_t, Mesh*> meshes;            // Prototypes, scenes get copies with their own position and colour that share the snapshot
+    map<string, FileHash> fileHashes;       // Only rehashed when the file's time or size changes
+    uint64_t currentScene = 0;
+    int jobCount = 0;
+    std::atomic<bool> rendering{false};
+
+    // Current job
+    int width = 2400;
+    int height = 1600;
+    string outputPath = "render.jpg";
+    vector<ViewCamera> views;
+};
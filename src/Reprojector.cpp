@@ -0,0 +1,95 @@
+#include "Reprojector.h"
+
+void Reprojector::beginFrame(int width, int height, bool whole) {
+    source.assign(width * height, whole ? -1 : -2);
+}
+// Looks for point in the stored frame. On a match pixel takes its colour and true is returned
+bool Reprojector::reuse(int pixel, const glm::vec3& point, const glm::vec3& normal, int objectId, const glm::vec3& cameraPosition,
+                        glm::vec3& color, float& variance) {
+    if(!valid) return false;
+    glm::vec3 d = point - this->cameraPosition;
+    float z = glm::dot(d, forward);
+    if(z <= 0) return false;
+    glm::vec2 p = (focal * glm::vec2(glm::dot(d, right), glm::dot(d, up)) / z + pixelOffset) * pixelScale - 0.5f;
+
+    // Of the 2 x 2 old pixels around it, the one shaded closest to the hit on the same surface
+    // (same object, facing the same way) wins
+    int x0 = (int)floor(p.x), v0 = (int)floor(p.y);
+    float pixelSize = z / (focal * pixelScale.x);
+    float bestDistance = maxDrift * pixelSize;
+    int j = -1;
+    for(int v = std::max(v0, 0); v <= std::min(v0 + 1, height - 1); v++) {
+        for(int x = std::max(x0, 0); x <= std::min(x0 + 1, width - 1); x++) {
+            int k = (height - 1 - v) * width + x;
+            if(this->objectId[k] != objectId || glm::dot(this->normal[k], normal) < normalCosine) continue;
+            float distance = glm::distance(shadedAt[k], point);
+            if(distance <= bestDistance) {
+                bestDistance = distance;
+                j = k;
+            }
+        }
+    }
+    if(j < 0) return false;
+
+    // And shaded from close enough to where we look from now
+    glm::vec3 toShading = glm::normalize(shadedFrom[j] - point);
+    glm::vec3 toCamera = glm::normalize(cameraPosition - point);
+    if(glm::dot(toShading, toCamera) < cos(glm::radians(maxViewAngle))) return false;
+
+    color = this->color[j];
+    variance = this->variance[j];
+    source[pixel] = j;
+    return true;
+}
+// Keeps the frame in buffer (color being its colours before the post passes) for the next one
+void Reprojector::store(const RenderBuffer& buffer, const vector<glm::vec3>& color, RenderCam& cam, ThreadPool& pool) {
+    int size = buffer.width * buffer.height;
+    bool keep = valid && buffer.width == width && buffer.height == height && source.size() == size;
+    // Camera frame, same as the rasteriser's. Centre ray of pixel (x, v) is rayOrigin + x rayStepX + v rayStepY, unnormalised
+    glm::vec3 camRight = cam.toWorldDirection(glm::vec3(1, 0, 0));
+    glm::vec3 camUp = cam.toWorldDirection(glm::vec3(0, 1, 0));
+    glm::vec3 camForward = -cam.toWorldDirection(glm::vec3(0, 0, 1));
+    float camFocal = cam.position.z - cam.view.position.z;
+    glm::vec2 camScale(buffer.width / cam.view.width(), buffer.height / cam.view.height());
+    glm::vec2 camOffset(cam.position.x - cam.view.min.x, cam.position.y - cam.view.min.y);
+    glm::vec3 rayOrigin = camRight * (0.5f / camScale.x - camOffset.x) + camUp * (0.5f / camScale.y - camOffset.y) + camForward * camFocal;
+    glm::vec3 rayStepX = camRight / camScale.x;
+    glm::vec3 rayStepY = camUp / camScale.y;
+
+    // Traced pixels were shaded here and now, reused ones carry over where their colour came from
+    vector<glm::vec3> nextShadedAt(size), nextShadedFrom(size);
+    pool.parallelFor(buffer.height, [&](int y) {
+        int v = buffer.height - 1 - y;
+        for(int x = 0; x < buffer.width; x++) {
+            int i = buffer.index(x, y);
+            int from = keep ? source[i] : -1;
+            if(from == -1) {
+                glm::vec3 direction = glm::normalize(rayOrigin + float(x) * rayStepX + float(v) * rayStepY);
+                nextShadedAt[i] = cam.position + direction * buffer.depth[i];
+                nextShadedFrom[i] = cam.position;
+            } else {
+                int j = from == -2 ? i : from;
+                nextShadedAt[i] = shadedAt[j];
+                nextShadedFrom[i] = shadedFrom[j];
+            }
+        }
+    }, 4);
+    shadedAt.swap(nextShadedAt);
+    shadedFrom.swap(nextShadedFrom);
+
+    width = buffer.width;
+    height = buffer.height;
+    cameraPosition = cam.position;
+    right = camRight;
+    up = camUp;
+    forward = camForward;
+    focal = camFocal;
+    pixelScale = camScale;
+    pixelOffset = camOffset;
+    normal = buffer.normal;
+    objectId = buffer.objectId;
+    this->color = color;
+    variance = buffer.variance;
+    source.clear();
+    valid = true;
+}
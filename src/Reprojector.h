@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "RenderBuffer.h"
+#include "ThreadPool.h"
+
+/*  Keeps the last frame's surface points and colours, so when only the render cam moved the
+ renderer can reuse a pixel's shading instead of tracing its shadows and reflections again.
+ A new pixel's primary hit is projected into the old camera and takes the nearest old pixel's
+ colour if that pixel saw the same object within maxDrift pixels of the hit with about the same
+ normal, and the colour was shaded from a viewpoint close enough in angle (specular and
+ reflections depend on it). Anything disoccluded, off the old frame or seen from too different
+ an angle is traced.
+ Reused colours keep the point and viewpoint they were really shaded at, so the error stays
+ within those limits however many frames a colour is carried through.
+ */
+class Reprojector {
+public:
+    // Methods
+    //
+    void beginFrame(int width, int height, bool whole);    // whole: every pixel gets traced or reused, else only marked ones change
+    void markTraced(int pixel) { if(!source.empty()) source[pixel] = -1; }
+    bool reuse(int pixel, const glm::vec3& point, const glm::vec3& normal, int objectId, const glm::vec3& cameraPosition,
+               glm::vec3& color, float& variance);
+    void store(const RenderBuffer& buffer, const vector<glm::vec3>& color, RenderCam& cam, ThreadPool& pool);
+    void invalidate() { valid = false; }
+    bool isValid() { return valid; }
+
+    // Variables
+    //
+    float maxDrift = 1.0f;              // Pixels between the hit and where the colour was shaded
+    float normalCosine = 0.95f;
+    float maxViewAngle = 4.0f;          // Degrees between the shading viewpoint and now, seen from the point
+
+private:
+    bool valid = false;
+    int width = 0, height = 0;
+
+    // The stored frame, rows top to bottom like the render buffer
+    vector<glm::vec3> normal;
+    vector<int> objectId;
+    vector<glm::vec3> color;
+    vector<float> variance;
+    vector<glm::vec3> shadedAt;         // Surface point the colour was shaded at
+    vector<glm::vec3> shadedFrom;       // and the camera position it was seen from
+
+    // Where each pixel of the frame being rendered comes from: -1 traced, -2 kept as it was, else a stored pixel
+    vector<int> source;
+
+    // Stored camera's frame for projecting into it, same as the rasteriser's
+    glm::vec3 cameraPosition, right, up, forward;
+    float focal;
+    glm::vec2 pixelScale, pixelOffset;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Low discrepancy sampling helpers.
+//  Points come from the first two Sobol dimensions, randomised per pixel with an XOR
+//  (digit) scramble. That keeps the stratification of every power of two prefix, so the
+//  first 4 samples of a pixel always land in different quadrants.
+//
+
+// Integer hash (lowbias32), used to turn pixel coordinates into scramble seeds
+inline uint32_t hashSeed(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+inline uint32_t pixelSeed(int u, int v) {
+    return hashSeed((uint32_t)u * 0x9E3779B1u ^ hashSeed((uint32_t)v));
+}
+
+// Sobol dimension 0 is the base 2 van der Corput sequence, i.e. the bit reversed index
+inline uint32_t sobolDimension0(uint32_t index) {
+    index = (index << 16) | (index >> 16);
+    index = ((index & 0x00ff00ffu) << 8) | ((index & 0xff00ff00u) >> 8);
+    index = ((index & 0x0f0f0f0fu) << 4) | ((index & 0xf0f0f0f0u) >> 4);
+    index = ((index & 0x33333333u) << 2) | ((index & 0xccccccccu) >> 2);
+    index = ((index & 0x55555555u) << 1) | ((index & 0xaaaaaaaau) >> 1);
+    return index;
+}
+inline uint32_t sobolDimension1(uint32_t index) {
+    uint32_t result = 0;
+    for(uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if(index & 1) result ^= v;
+    }
+    return result;
+}
+// Scrambled 2D Sobol point in [0, 1)^2
+inline glm::vec2 sobol2D(uint32_t index, uint32_t seed) {
+    uint32_t x = sobolDimension0(index) ^ hashSeed(seed);
+    uint32_t y = sobolDimension1(index) ^ hashSeed(seed ^ 0x68bc21ebu);
+    return glm::vec2(x * 2.3283064e-10f, y * 2.3283064e-10f);
+}
+
+// Shirley-Chiu concentric map from the unit square to the unit disk, keeps strata intact
+inline glm::vec2 concentricDisk(glm::vec2 p) {
+    float a = 2.0f * p.x - 1.0f;
+    float b = 2.0f * p.y - 1.0f;
+    if(a == 0.0f && b == 0.0f) return glm::vec2(0, 0);
+    float r, phi;
+    if(a * a > b * b) {
+        r = a;
+        phi = (PI / 4) * (b / a);
+    } else {
+        r = b;
+        phi = (PI / 2) - (PI / 4) * (a / b);
+    }
+    return glm::vec2(r * cos(phi), r * sin(phi));
+}
@@ -0,0 +1,128 @@
+#include "ShadowMaps.h"
+#include "ofApp.h"
+
+// Everything the maps depend on: object bounds and lights, not colours or materials
+uint64_t ShadowMaps::keyOf(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights) {
+    uint64_t key = hashBytes(&resolution, sizeof(resolution));
+    key = hashBytes(&maxSpotAngle, sizeof(maxSpotAngle), key);
+    for(auto obj : scene) {
+        AABB box = obj->getBounds();
+        key = hashBytes(&obj, sizeof(obj), key);
+        key = hashBytes(&obj->position, sizeof(obj->position), key);
+        key = hashBytes(&box, sizeof(box), key);
+    }
+    for(auto light : lights) {
+        key = hashBytes(&light, sizeof(light), key);
+        key = hashBytes(&light->position, sizeof(light->position), key);
+        SpotLight* spot = dynamic_cast<SpotLight*>(light);
+        if(spot) {
+            key = hashBytes(&spot->angle, sizeof(spot->angle), key);
+            if(spot->anchor) key = hashBytes(&spot->anchor->position, sizeof(spot->anchor->position), key);
+        }
+    }
+    return key | 1;     // Never 0, that means invalid
+}
+// Traces the maps. Needs the app's scene BVH built for this frame
+void ShadowMaps::build(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, ThreadPool& pool) {
+    uint64_t key = keyOf(scene, lights);
+    if(key == sceneKey) return;
+    sceneKey = key;
+
+    maps.clear();
+    for(auto light : lights) {
+        if(dynamic_cast<LightAnchor*>(light)) continue;     // Casts no light
+        LightMap map;
+        map.light = light;
+        map.size = std::max(1, resolution);
+        map.position = light->position;
+        const SpotLight* spot = dynamic_cast<const SpotLight*>(light);
+        if(spot && spot->anchor && spot->anchor->position != spot->position) {
+            // Same cone as SpotLight::getIntensity()
+            float halfAngle = acos(glm::clamp((float)std::cos(spot->angle), -1.0f, 1.0f));
+            if(halfAngle <= glm::radians(maxSpotAngle)) {
+                map.cube = false;
+                map.forward = glm::normalize(spot->anchor->position - spot->position);
+                glm::vec3 helper = glm::abs(map.forward.y) > 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+                map.right = glm::normalize(glm::cross(map.forward, helper));
+                map.up = glm::cross(map.right, map.forward);
+                map.tanHalfAngle = tan(halfAngle) * 1.01f;   // A little past the cone so PCF at its edge stays inside
+            }
+        }
+        int faces = map.cube ? 6 : 1;
+        map.depth.resize(size_t(faces) * map.size * map.size);
+        maps.push_back(map);
+    }
+
+    for(auto& map : maps) {
+        int faces = map.cube ? 6 : 1;
+        pool.parallelFor(faces * map.size, [this, &map](int row) {
+            int face = row / map.size;
+            int y = row % map.size;
+            for(int x = 0; x < map.size; x++) {
+                glm::vec3 point, normal;
+                Ray ray(map.position, texelDirection(map, face, x, y));
+                SceneObject* hit = app.shortestIntersection(ray, point, normal);
+                map.depth[(size_t(face) * map.size + y) * map.size + x] = hit ? glm::distance(map.position, point) : std::numeric_limits<float>::max();
+            }
+        }, 4);
+    }
+}
+// Cube face f looks down axis f / 2, positive for even f. Its texel u runs along the next axis and v the one after
+glm::vec3 ShadowMaps::texelDirection(const LightMap& map, int face, int x, int y) const {
+    glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / float(map.size) * 2.0f - 1.0f;
+    if(!map.cube) {
+        return glm::normalize(map.forward + (map.right * uv.x + map.up * uv.y) * map.tanHalfAngle);
+    }
+    int axis = face / 2;
+    glm::vec3 direction;
+    direction[axis] = face % 2 == 0 ? 1.0f : -1.0f;
+    direction[(axis + 1) % 3] = uv.x;
+    direction[(axis + 2) % 3] = uv.y;
+    return glm::normalize(direction);
+}
+// Map face and continuous texel coordinates of a direction from the light, false if it's off the map
+bool ShadowMaps::project(const LightMap& map, const glm::vec3& direction, int& face, glm::vec2& texel) const {
+    glm::vec2 uv;
+    if(map.cube) {
+        glm::vec3 a = glm::abs(direction);
+        int axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+        if(a[axis] <= 0) return false;
+        face = axis * 2 + (direction[axis] < 0 ? 1 : 0);
+        uv = glm::vec2(direction[(axis + 1) % 3], direction[(axis + 2) % 3]) / a[axis];
+    } else {
+        float z = glm::dot(direction, map.forward);
+        if(z <= 0) return false;
+        face = 0;
+        uv = glm::vec2(glm::dot(direction, map.right), glm::dot(direction, map.up)) / (z * map.tanHalfAngle);
+        if(glm::abs(uv.x) > 1 || glm::abs(uv.y) > 1) return false;
+    }
+    texel = (uv + 1.0f) * 0.5f * float(map.size) - 0.5f;
+    return true;
+}
+float ShadowMaps::visibility(const BaseLight& light, const glm::vec3& point) const {
+    const LightMap* map = nullptr;
+    for(auto& m : maps) {
+        if(m.light == &light) map = &m;
+    }
+    if(map == nullptr || map->position != light.position) return -1;
+
+    glm::vec3 direction = point - map->position;
+    float distance = glm::length(direction);
+    int face;
+    glm::vec2 texel;
+    if(distance <= 0 || !project(*map, direction, face, texel)) return -1;
+
+    float texelWidth = 2.0f * map->tanHalfAngle / map->size;
+    float test = distance - constantBias - texelBias * texelWidth * distance;
+    int cx = (int)round(texel.x), cy = (int)round(texel.y);
+    const float* depth = &map->depth[size_t(face) * map->size * map->size];
+    int lit = 0, taps = 0;
+    for(int y = cy - pcfRadius; y <= cy + pcfRadius; y++) {
+        int row = std::min(std::max(y, 0), map->size - 1) * map->size;
+        for(int x = cx - pcfRadius; x <= cx + pcfRadius; x++) {
+            lit += test <= depth[row + std::min(std::max(x, 0), map->size - 1)];
+            taps++;
+        }
+    }
+    return float(lit) / taps;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "ThreadPool.h"
+#include "ContentHash.h"
+
+class ofApp;
+
+/*  Preview quality shadows. Each point light gets a cube of depth maps around it, each spot light
+ one map over its cone, aimed at its anchor (spots wider than maxSpotAngle get a cube too). The
+ maps are filled by casting a ray from the light through every texel, so they see spheres, planes
+ and meshes alike, and hold the distance to the first hit. A shadow test is then a
+ percentage-closer lookup: the (2 pcfRadius + 1)^2 texels around the point's direction are each
+ compared against its distance, and the share that pass is the visibility. That takes the place
+ of shadowSamples rays per light, area lights included, so the penumbrae are the filter's width
+ and not the light's.
+ Maps are only rebuilt when a light or an object's bounds changed, or the resolution did.
+ */
+class ShadowMaps {
+public:
+    // Methods
+    //
+    ShadowMaps(ofApp& app) : app(app) {}
+    void build(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights, ThreadPool& pool);
+    float visibility(const BaseLight& light, const glm::vec3& point) const;     // -1 if the light has no map there
+    void invalidate() { sceneKey = 0; }
+
+    // Variables
+    //
+    int resolution = 256;           // Texels along a side of each map
+    int pcfRadius = 1;
+    float constantBias = 0.02f;     // Distance a point may be behind the stored depth and still be lit,
+    float texelBias = 2.0f;         // plus this many texels' width at its distance
+    float maxSpotAngle = 75;        // Degrees, half angle
+
+private:
+    struct LightMap {
+        const BaseLight* light = nullptr;
+        bool cube = true;
+        int size = 0;
+        glm::vec3 position;
+        glm::vec3 right, up, forward;   // Spot maps only
+        float tanHalfAngle = 1;         // Half width of a spot map in tangent units, 1 for cube faces
+        vector<float> depth;            // size x size per face, distance to the first hit
+    };
+    glm::vec3 texelDirection(const LightMap& map, int face, int x, int y) const;
+    bool project(const LightMap& map, const glm::vec3& direction, int& face, glm::vec2& texel) const;
+    uint64_t keyOf(const vector<SceneObject*>& scene, const vector<BaseLight*>& lights);
+
+    ofApp& app;
+    vector<LightMap> maps;
+    uint64_t sceneKey = 0;
+};
@@ -0,0 +1,224 @@
+#include "TextureCache.h"
+
+static const char tiledMagic[8] = {'R', 'T', 'T', 'I', 'L', 'E', 0, 0};
+static const uint32_t tiledVersion = 1;
+static const int microCacheSize = 16;      // Tiles per thread, direct mapped
+
+// The tiles one thread used last. Entries are tagged with the cache they came from
+struct MicroCache {
+    uint64_t owner[microCacheSize] = {};
+    uint64_t key[microCacheSize] = {};
+    const unsigned char* tile[microCacheSize] = {};
+};
+static std::atomic<uint64_t> nextCacheId{1};
+
+static bool openTiled(MappedFile& file, const string& path) {
+    if(!file.open(path) || file.getSize() < sizeof(TiledTextureHeader)) return false;
+    const TiledTextureHeader* h = (const TiledTextureHeader*)file.getData();
+    bool valid = memcmp(h->magic, tiledMagic, 8) == 0 && h->version == tiledVersion && h->levelCount > 0 &&
+                 h->channels >= 1 && h->channels <= 4 && h->tileSize > 0 &&
+                 sizeof(TiledTextureHeader) + h->levelCount * sizeof(TiledTextureLevel) <= file.getSize();
+    if(valid) {
+        const TiledTextureLevel& last = ((const TiledTextureLevel*)(h + 1))[h->levelCount - 1];
+        size_t tileBytes = size_t(h->tileSize) * h->tileSize * h->channels;
+        valid = last.offset + last.tilesX * last.tilesY * tileBytes <= file.getSize();
+    }
+    if(!valid) file.close();
+    return valid;
+}
+
+TextureCache::TextureCache() {
+    id = nextCacheId++;
+}
+TextureCache::~TextureCache() {
+    for(auto texture : textures) delete texture;
+}
+TextureCache& TextureCache::shared() {
+    static TextureCache cache;
+    return cache;
+}
+int TextureCache::add(const string& filePath) {
+    ofBuffer file = ofBufferFromFile(filePath, true);
+    if(file.size() == 0) {
+        cout << "Could not open texture " << filePath << endl;
+        return -1;
+    }
+    uint64_t hash = hashBytes(file.getData(), file.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = handles.find(hash);
+        if(it != handles.end()) return it->second;
+    }
+
+    // Convert on first sight, after that the tiled file is just mapped
+    string tiledPath = ofToDataPath(cacheDirectory + "/" + ofToHex(hash) + ".tiled");
+    TiledTexture* texture = new TiledTexture();
+    if(!openTiled(texture->file, tiledPath)) {
+        ofPixels pixels;
+        if(!ofLoadImage(pixels, file)) {
+            cout << "Could not decode texture " << filePath << endl;
+            delete texture;
+            return -1;
+        }
+        if(!convert(pixels, tiledPath, tileSize) || !openTiled(texture->file, tiledPath)) {
+            cout << "Could not write tiled texture " << tiledPath << endl;
+            delete texture;
+            return -1;
+        }
+    }
+    texture->header = (const TiledTextureHeader*)texture->file.getData();
+    texture->levels = (const TiledTextureLevel*)(texture->header + 1);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = handles.find(hash);      // Someone else may have added the same image meanwhile
+    if(it != handles.end()) {
+        delete texture;
+        return it->second;
+    }
+    textures.push_back(texture);
+    handles[hash] = textures.size() - 1;
+    return textures.size() - 1;
+}
+glm::ivec2 TextureCache::getSize(int texture) {
+    if(texture < 0 || texture >= textures.size()) return glm::ivec2(0, 0);
+    return glm::ivec2(textures[texture]->header->width, textures[texture]->header->height);
+}
+// Nearest texel of the mip level where a pixel covers about one texel. uv is in [0, 1], v going down the image
+ofColor TextureCache::lookup(int texture, glm::vec2 uv, float texelsPerPixel) {
+    if(texture < 0 || texture >= textures.size()) return ofColor::black;
+    const TiledTexture* t = textures[texture];
+    int level = texelsPerPixel > 1.0f ? std::min<int>(t->header->levelCount - 1, (int)log2(texelsPerPixel)) : 0;
+    const TiledTextureLevel& l = t->levels[level];
+    int x = glm::clamp((int)(uv.x * l.width), 0, (int)l.width - 1);
+    int y = glm::clamp((int)(uv.y * l.height), 0, (int)l.height - 1);
+    int size = t->header->tileSize;
+    int tile = (y / size) * l.tilesX + x / size;
+
+    static thread_local MicroCache micro;
+    uint64_t key = (uint64_t)texture << 40 | (uint64_t)level << 32 | tile;
+    int slot = (tile ^ (texture * 31 + level) * 7) & (microCacheSize - 1);
+    if(micro.owner[slot] != id || micro.key[slot] != key) {
+        micro.owner[slot] = id;
+        micro.key[slot] = key;
+        micro.tile[slot] = touchTile(texture, level, tile);
+    }
+
+    int channels = t->header->channels;
+    const unsigned char* p = micro.tile[slot] + ((y % size) * size + x % size) * channels;
+    switch(channels) {
+        case 1: return ofColor(p[0], p[0], p[0]);
+        case 2: return ofColor(p[0], p[0], p[0], p[1]);
+        case 3: return ofColor(p[0], p[1], p[2]);
+        default: return ofColor(p[0], p[1], p[2], p[3]);
+    }
+}
+// Returns the tile's texels and records the use, evicting old tiles when over budget
+const unsigned char* TextureCache::touchTile(int texture, int level, int tile) {
+    TiledTexture* t = textures[texture];
+    size_t tileBytes = size_t(t->header->tileSize) * t->header->tileSize * t->header->channels;
+    size_t offset = t->levels[level].offset + tile * tileBytes;
+    uint64_t key = (uint64_t)texture << 40 | (uint64_t)level << 32 | tile;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = lruPosition.find(key);
+    if(it != lruPosition.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+    } else {
+        t->file.adviseWillNeed(offset, tileBytes);
+        lru.push_front(key);
+        lruPosition[key] = lru.begin();
+        residentBytes += tileBytes;
+
+        while(residentBytes > maxBytes && lru.size() > 1) {
+            uint64_t evicted = lru.back();
+            lru.pop_back();
+            lruPosition.erase(evicted);
+            TiledTexture* e = textures[evicted >> 40];
+            size_t evictedBytes = size_t(e->header->tileSize) * e->header->tileSize * e->header->channels;
+            e->file.adviseDontNeed(e->levels[(evicted >> 32) & 0xFF].offset + (evicted & 0xFFFFFFFFu) * evictedBytes, evictedBytes);
+            residentBytes -= evictedBytes;
+        }
+    }
+    return (const unsigned char*)t->file.getData() + offset;
+}
+/* Writes pixels as a tiled texture with a full mip chain, each level a 2x2 box filter of the one
+ above. Written under a temporary name and renamed, so another process never maps half a file. */
+bool TextureCache::convert(const ofPixels& pixels, const string& tiledFile, int tileSize) {
+    int channels = pixels.getNumChannels();
+    if(pixels.getWidth() == 0 || pixels.getHeight() == 0 || channels < 1 || channels > 4 || tileSize < 1) return false;
+
+    vector<ofPixels> mips;      // Levels 1 and down
+    auto levelPixels = [&pixels, &mips](int level) -> const ofPixels& { return level == 0 ? pixels : mips[level - 1]; };
+    for(int level = 1; levelPixels(level - 1).getWidth() > 1 || levelPixels(level - 1).getHeight() > 1; level++) {
+        const ofPixels& above = levelPixels(level - 1);
+        int aboveWidth = above.getWidth(), aboveHeight = above.getHeight();
+        int width = std::max(1, aboveWidth / 2), height = std::max(1, aboveHeight / 2);
+        ofPixels next;
+        next.allocate(width, height, channels);
+        const unsigned char* in = above.getData();
+        unsigned char* out = next.getData();
+        for(int y = 0; y < height; y++) {
+            int y0 = std::min(2 * y, aboveHeight - 1), y1 = std::min(2 * y + 1, aboveHeight - 1);
+            for(int x = 0; x < width; x++) {
+                int x0 = std::min(2 * x, aboveWidth - 1), x1 = std::min(2 * x + 1, aboveWidth - 1);
+                for(int c = 0; c < channels; c++) {
+                    int sum = in[(y0 * aboveWidth + x0) * channels + c] + in[(y0 * aboveWidth + x1) * channels + c] +
+                              in[(y1 * aboveWidth + x0) * channels + c] + in[(y1 * aboveWidth + x1) * channels + c];
+                    out[(y * width + x) * channels + c] = (sum + 2) / 4;
+                }
+            }
+        }
+        mips.push_back(next);
+    }
+
+    TiledTextureHeader header = {};
+    memcpy(header.magic, tiledMagic, 8);
+    header.version = tiledVersion;
+    header.width = pixels.getWidth();
+    header.height = pixels.getHeight();
+    header.channels = channels;
+    header.tileSize = tileSize;
+    header.levelCount = mips.size() + 1;
+    size_t tileBytes = size_t(tileSize) * tileSize * channels;
+    vector<TiledTextureLevel> levels(header.levelCount);
+    uint64_t offset = sizeof(TiledTextureHeader) + levels.size() * sizeof(TiledTextureLevel);
+    for(int level = 0; level < levels.size(); level++) {
+        levels[level].width = levelPixels(level).getWidth();
+        levels[level].height = levelPixels(level).getHeight();
+        levels[level].tilesX = (levels[level].width + tileSize - 1) / tileSize;
+        levels[level].tilesY = (levels[level].height + tileSize - 1) / tileSize;
+        levels[level].offset = offset;
+        offset += levels[level].tilesX * levels[level].tilesY * tileBytes;
+    }
+
+    ofDirectory::createDirectory(ofFilePath::getEnclosingDirectory(tiledFile), false, true);
+    string temporaryPath = temporaryFilePath(tiledFile);
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)levels.data(), levels.size() * sizeof(TiledTextureLevel));
+        vector<unsigned char> tile(tileBytes);
+        for(int level = 0; level < levels.size(); level++) {
+            const TiledTextureLevel& l = levels[level];
+            const unsigned char* data = levelPixels(level).getData();
+            for(int ty = 0; ty < l.tilesY; ty++) {
+                for(int tx = 0; tx < l.tilesX; tx++) {
+                    // Edge tiles are padded with black, lookups never read past the level
+                    std::fill(tile.begin(), tile.end(), 0);
+                    int rows = std::min<int>(tileSize, l.height - ty * tileSize);
+                    int columns = std::min<int>(tileSize, l.width - tx * tileSize);
+                    for(int row = 0; row < rows; row++) {
+                        memcpy(&tile[row * tileSize * channels], data + ((size_t(ty) * tileSize + row) * l.width + tx * tileSize) * channels, columns * channels);
+                    }
+                    file.write((const char*)tile.data(), tileBytes);
+                }
+            }
+        }
+        if(!file.good()) {
+            file.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    return std::rename(temporaryPath.c_str(), tiledFile.c_str()) == 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ofMain.h"
+#include "MappedFile.h"
+#include "ContentHash.h"
+
+//  On-disk layout of a tiled texture, offsets are from the file start:
+//    TiledTextureHeader
+//    TiledTextureLevel[levelCount]    level 0 is full size, each next one half that, down to 1x1
+//    tiles                            per level, row major, tileSize x tileSize x channels bytes each
+//
+struct TiledTextureHeader {
+    char magic[8];              // "RTTILE\0\0"
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t tileSize;
+    uint32_t levelCount;
+};
+struct TiledTextureLevel {
+    uint32_t width;
+    uint32_t height;
+    uint32_t tilesX;
+    uint32_t tilesY;
+    uint64_t offset;            // Byte offset of the level's first tile
+};
+
+/*  Texture cache in the style of OpenImageIO's. Textures are converted once to tiled, mip mapped
+ files in cacheDirectory (keyed by a hash of the image file) and memory mapped. Tiles are paged in
+ on first touch and dropped again least-recently-used first once more than maxBytes of them are
+ resident, so a plane far away only ever reads a few tiles of a small mip level.
+ Each thread keeps a small micro-cache of the tiles it used last, so most lookups never take the
+ lock. Like the out of core mesh, eviction only tells the OS the pages can go, so a tile pointer a
+ micro-cache still holds stays readable.
+ add() is for scene setup, don't call it while a render is running.
+ */
+class TextureCache {
+public:
+    // Methods
+    //
+    TextureCache();
+    ~TextureCache();
+    int add(const string& filePath);    // Handle for lookup(), -1 if the image can't be read
+    ofColor lookup(int texture, glm::vec2 uv, float texelsPerPixel = 1.0f);
+    glm::ivec2 getSize(int texture);
+    static bool convert(const ofPixels& pixels, const string& tiledFile, int tileSize = 64);
+    static TextureCache& shared();
+
+    // Variables
+    //
+    size_t maxBytes = 256 * 1024 * 1024;
+    size_t residentBytes = 0;
+    string cacheDirectory = "cache/tiles";
+    int tileSize = 64;                  // For newly converted textures
+
+private:
+    struct TiledTexture {
+        MappedFile file;
+        const TiledTextureHeader* header = nullptr;
+        const TiledTextureLevel* levels = nullptr;
+    };
+    const unsigned char* touchTile(int texture, int level, int tile);
+
+    uint64_t id;                        // Tags micro-cache entries, unique for every cache ever made
+    std::mutex mutex;
+    vector<TiledTexture*> textures;
+    map<uint64_t, int> handles;         // Content hash of the image file -> handle
+
+    // LRU of resident tiles, most recently used at the front. Keys are texture << 40 | level << 32 | tile
+    std::list<uint64_t> lru;
+    unordered_map<uint64_t, std::list<uint64_t>::iterator> lruPosition;
+};
@@ -0,0 +1,86 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threadCount) {
+    if(threadCount <= 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for(int i = 0; i < threadCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+void ThreadPool::workerLoop() {
+    while(true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if(stopping && tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+std::future<void> ThreadPool::enqueue(std::function<void()> task) {
+    std::packaged_task<void()> packaged(task);
+    std::future<void> result = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        tasks.push_back(std::move(packaged));
+    }
+    condition.notify_one();
+    return result;
+}
+// Runs body(0) .. body(count - 1) across the pool in chunks of grain, returns when all are done.
+void ThreadPool::parallelFor(int count, std::function<void(int)> body, int grain) {
+    if(count <= 0) return;
+    grain = std::max(1, grain);
+    
+    // Shared with helper tasks that may only get scheduled after we've returned
+    struct Job {
+        std::function<void(int)> body;
+        int count, grain;
+        std::atomic<int> next{0};
+        std::atomic<int> finished{0};
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto job = make_shared<Job>();
+    job->body = body;
+    job->count = count;
+    job->grain = grain;
+    
+    auto run = [job]() {
+        int begin;
+        while((begin = job->next.fetch_add(job->grain)) < job->count) {
+            int end = std::min(begin + job->grain, job->count);
+            for(int i = begin; i < end; i++) {
+                job->body(i);
+            }
+            if(job->finished.fetch_add(end - begin) + (end - begin) == job->count) {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->done.notify_all();
+            }
+        }
+    };
+    int helpers = std::min((int)workers.size(), (count + grain - 1) / grain - 1);
+    for(int i = 0; i < helpers; i++) {
+        enqueue(run);
+    }
+    run();
+    
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->done.wait(lock, [&job] { return job->finished.load() == job->count; });
+}
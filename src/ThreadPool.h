@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Fixed size pool of worker threads shared by the renderer.
+//  parallelFor() lets the calling thread help out, so it is safe to call from a worker.
+//
+class ThreadPool {
+public:
+    // Methods
+    //
+    ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+    std::future<void> enqueue(std::function<void()> task);
+    void parallelFor(int count, std::function<void(int)> body, int grain = 1);
+    int size() { return workers.size(); }
+    static ThreadPool& shared();
+
+private:
+    void workerLoop();
+
+    // Variables
+    //
+    vector<std::thread> workers;
+    std::deque<std::packaged_task<void()>> tasks;
+    std::mutex queueMutex;
+    std::condition_variable condition;
+    bool stopping = false;
+};
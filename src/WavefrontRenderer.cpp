@@ -0,0 +1,294 @@
+#include "WavefrontRenderer.h"
+#include "ofApp.h"
+#include "Morton.h"
+
+void WavefrontRenderer::render(RenderBuffer& buffer) {
+    render(buffer, 0, buffer.height);
+}
+// Buffer rows [firstRow, firstRow + rowCount) only
+void WavefrontRenderer::render(RenderBuffer& buffer, int firstRow, int rowCount) {
+    materialIndex.clear();
+    for(int i = 0; i < app.scene.size(); i++) {
+        materialIndex[app.scene[i]] = i;
+    }
+    int waveRows = rowsPerWave(buffer.width);
+    for(int row = firstRow; row < firstRow + rowCount && !app.cancelRender; row += waveRows) {
+        renderWave(buffer, row, std::min(waveRows, firstRow + rowCount - row));
+    }
+}
+int WavefrontRenderer::rowsPerWave(int width) {
+    return std::max(1, waveSize / (width * app.samplesPerPixel));
+}
+void WavefrontRenderer::renderWave(RenderBuffer& buffer, int firstRow, int rowCount) {
+    ThreadPool& pool = ThreadPool::shared();
+    int width = buffer.width;
+    int height = buffer.imageHeight;
+    int spp = app.samplesPerPixel;
+    int pixelCount = width * rowCount;
+    uint64_t allLights = app.sceneLights.size() >= 64 ? ~0ull : (1ull << app.sceneLights.size()) - 1;
+    
+    // Stage 1: centre rays for the feature buffers, then the jittered camera rays
+    paths.resize(pixelCount * spp);
+    centerHits.resize(pixelCount);
+    sampleColor.assign(pixelCount * spp, glm::vec3(0, 0, 0));
+    pool.parallelFor(rowCount, [&](int r) {
+        int y = firstRow + r;
+        int v = buffer.viewRow(y);
+        for(int x = 0; x < width; x++) {
+            int pixel = r * width + x;
+            int i = buffer.index(x, y);
+            uint32_t seed = pixelSeed(x, v);
+            Ray centerRay = app.renderCam.getRay(float(x + 0.5) / width, float(v + 0.5) / height);
+            
+            glm::vec3 point, normal;
+            SceneObject* obj = app.primaryHit(centerRay, x, v, point, normal);
+            centerHits[pixel].object = obj;
+            centerHits[pixel].point = point;
+            centerHits[pixel].normal = normal;
+            if(obj != nullptr) {
+                ofColor diffuse = obj->getDiffuseColor(point, app.pixelFootprint(centerRay.position, point));
+                buffer.albedo[i] = glm::vec3(diffuse.r, diffuse.g, diffuse.b) / 255.0f;
+                buffer.normal[i] = normal;
+                buffer.depth[i] = glm::distance(centerRay.position, point);
+                buffer.objectId[i] = materialIndex.at(obj);
+            }
+            for(int s = 0; s < spp; s++) {
+                Ray cameraRay = centerRay;
+                if(spp > 1) {
+                    glm::vec2 jitter = sobol2D(s, seed ^ 0x5bd1e995u);
+                    cameraRay = app.renderCam.getRay((x + jitter.x) / width, (v + jitter.y) / height);
+                }
+                WavefrontPath& path = paths[pixel * spp + s];
+                path.origin = cameraRay.position;
+                path.direction = cameraRay.direction;
+                path.sample = pixel * spp + s;
+                path.iterations = app.lightBounces;
+                path.weight = 1.0f;
+                path.seed = hashSeed(seed + s);
+                path.lightMask = allLights;
+            }
+        }
+    }, 4);
+
+    // With one sample per pixel the camera paths are the centre rays, so they start out with only
+    // the lights their cluster can reach
+    if(spp == 1 && app.lightClusters.isEnabled()) {
+        clusterPoints.resize(pixelCount);
+        for(int p = 0; p < pixelCount; p++) clusterPoints[p] = centerHits[p].point;
+        app.lightClusters.build(clusterPoints.data(), &buffer.depth[buffer.index(0, firstRow)], width, rowCount, pool);
+        pool.parallelFor(rowCount, [&](int r) {
+            for(int x = 0; x < width; x++) {
+                SceneObject* obj = centerHits[r * width + x].object;
+                if(obj && app.needsAllLights(obj, app.lightBounces)) continue;
+                uint64_t mask = 0;
+                for(int l : app.lightClusters.lightsAt(x, r)) mask |= 1ull << l;
+                paths[r * width + x].lightMask = mask;
+            }
+        }, 4);
+    }
+    
+    // Stages 2 - 5, one bounce per loop
+    bool primary = true;
+    while(!paths.empty()) {
+        if(app.cancelRender) return;
+        intersectPaths(primary && spp == 1);
+        if(primary) {
+            // Ambient only depends on the camera ray's hit
+            pool.parallelFor(paths.size(), [&](int p) {
+                if(paths[p].iterations == 0) return;
+                const WavefrontHit* hit = hitBegin[p] >= 0 ? &hits[hitBegin[p]] : nullptr;
+                ofColor ambient = hit ? app.ambientColor(hit->object, hit->point, app.pixelFootprint(paths[p].origin, hit->point))
+                                      : app.ambientColor(nullptr, glm::vec3(0, 0, 0), 0);
+                sampleColor[paths[p].sample] += glm::vec3(ambient.r, ambient.g, ambient.b);
+            }, 256);
+            primary = false;
+        }
+        shadeHits();
+        paths.swap(nextPaths);
+        if(sortSecondaryRays) sortPaths();
+    }
+    
+    // Resolve the samples into the buffer
+    pool.parallelFor(rowCount, [&](int r) {
+        for(int x = 0; x < width; x++) {
+            int pixel = r * width + x;
+            int i = buffer.index(x, firstRow + r);
+            glm::vec3 colorSum = glm::vec3(0, 0, 0);
+            float luminanceSum = 0;
+            float luminanceSquaredSum = 0;
+            for(int s = 0; s < spp; s++) {
+                glm::vec3 color = glm::clamp(sampleColor[pixel * spp + s], 0.0f, 255.0f);
+                float luminance = 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+                colorSum += color;
+                luminanceSum += luminance;
+                luminanceSquaredSum += luminance * luminance;
+            }
+            float mean = luminanceSum / spp;
+            buffer.color[i] = colorSum / float(spp);
+            buffer.variance[i] = std::max(0.0f, luminanceSquaredSum / spp - mean * mean) / spp;
+        }
+    }, 4);
+}
+// Stage 2: find the closest hit of every live path, then compact the hits into a dense list.
+// With one sample per pixel the camera paths are the centre rays, whose hits stage 1 already found.
+void WavefrontRenderer::intersectPaths(bool useCenterHits) {
+    ThreadPool& pool = ThreadPool::shared();
+    vector<WavefrontHit> candidates(paths.size());
+    pool.parallelFor(paths.size(), [&](int p) {
+        WavefrontHit& hit = candidates[p];
+        hit.object = nullptr;
+        if(paths[p].iterations <= 0) return;
+        if(useCenterHits) {
+            hit = centerHits[p];
+        } else {
+            hit.object = app.shortestIntersection(Ray(paths[p].origin, paths[p].direction), hit.point, hit.normal);
+        }
+        hit.path = p;
+    }, 256);
+    
+    hits.clear();
+    hitBegin.assign(paths.size(), -1);
+    for(int p = 0; p < candidates.size(); p++) {
+        if(candidates[p].object == nullptr) continue;
+        candidates[p].material = materialIndex.at(candidates[p].object);
+        hitBegin[p] = hits.size();
+        hits.push_back(candidates[p]);
+    }
+}
+// Stages 3 - 5 for the current hits
+void WavefrontRenderer::shadeHits() {
+    ThreadPool& pool = ThreadPool::shared();
+    
+    // Stage 3: counting sort by material so each shading run stays on one object's code and textures
+    int materialCount = app.scene.size();
+    vector<int> binStart(materialCount + 1, 0);
+    for(const WavefrontHit& hit : hits) binStart[hit.material + 1]++;
+    for(int m = 0; m < materialCount; m++) binStart[m + 1] += binStart[m];
+    vector<WavefrontHit> binned(hits.size());
+    for(const WavefrontHit& hit : hits) binned[binStart[hit.material]++] = hit;
+    hits.swap(binned);
+    
+    pool.parallelFor(hits.size(), [&](int h) {
+        WavefrontHit& hit = hits[h];
+        float footprint = app.pixelFootprint(paths[hit.path].origin, hit.point);
+        hit.diffuse = hit.object->getDiffuseColor(hit.point, footprint);
+        hit.specular = hit.object->getSpecularColor(hit.point, footprint);
+    }, 256);
+    
+    // Stage 4: one shadow query per hit and live light, leaving out the lights that can't reach it
+    // unless the hit needs them all (a reflection only carries on from hits outside a light's shadow)
+    queryBegin.resize(hits.size() + 1);
+    shadowQueries.clear();
+    for(int h = 0; h < hits.size(); h++) {
+        queryBegin[h] = shadowQueries.size();
+        const WavefrontPath& path = paths[hits[h].path];
+        bool allLights = app.needsAllLights(hits[h].object, path.iterations);
+        for(int l = 0; l < app.sceneLights.size() && l < 64; l++) {
+            if(!(path.lightMask & (1ull << l))) continue;
+            bool reaches = app.lightReaches(hits[h].object, hits[h].point, *app.sceneLights[l]);
+            if(reaches || allLights) shadowQueries.push_back({h, l, reaches, 0.0f, glm::vec3(0, 0, 0)});
+        }
+    }
+    queryBegin[hits.size()] = shadowQueries.size();
+    
+    // Queries stay grouped by hit for stage 5, only the order they're traced in changes
+    shadowOrder.resize(shadowQueries.size());
+    for(int q = 0; q < shadowQueries.size(); q++) shadowOrder[q] = q;
+    if(sortSecondaryRays) sortShadowQueries();
+    
+    pool.parallelFor(shadowQueries.size(), [&](int k) {
+        if(app.cancelRender) return;    // The wave is thrown away
+        ShadowQuery& query = shadowQueries[shadowOrder[k]];
+        const WavefrontHit& hit = hits[query.hit];
+        const WavefrontPath& path = paths[hit.path];
+        BaseLight& light = *app.sceneLights[query.light];
+        
+        query.visibility = app.shadowVisibility(hit.point + hit.normal / SHADOWOFFSET, light, path.seed);
+        if(query.visibility == 0.0f || !query.lit) return;
+        ofColor direct = app.lambert(hit.point, hit.normal, hit.diffuse, light, hit.object->celShaded);
+        if(!hit.object->celShaded) {
+            direct += app.phong(Ray(path.origin, path.direction), hit.point, hit.normal, hit.specular, app.phongPower, light);
+        }
+        query.direct = glm::vec3(direct.r, direct.g, direct.b);
+    }, 64);
+    
+    // Stage 5: add up the lighting and queue reflections for the lights that weren't shadowed
+    nextPaths.resize(hits.size());
+    vector<char> spawned(hits.size(), 0);
+    pool.parallelFor(hits.size(), [&](int h) {
+        const WavefrontHit& hit = hits[h];
+        const WavefrontPath& path = paths[hit.path];
+        glm::vec3 color = glm::vec3(0, 0, 0);
+        uint64_t visibleLights = 0;
+        for(int q = queryBegin[h]; q < queryBegin[h + 1]; q++) {
+            if(shadowQueries[q].visibility == 0.0f) continue;
+            color += shadowQueries[q].direct * shadowQueries[q].visibility;
+            visibleLights |= 1ull << shadowQueries[q].light;
+        }
+        sampleColor[path.sample] += color * path.weight;    // Each sample has at most one path per wave
+        
+        if(visibleLights != 0 && path.iterations > 1) {
+            WavefrontPath& next = nextPaths[h];
+            next.origin = hit.point;
+            next.direction = app.reflectVector(path.direction, hit.normal);
+            next.sample = path.sample;
+            next.iterations = path.iterations - 1;
+            next.weight = path.weight * hit.object->reflectivity;
+            next.seed = hashSeed(path.seed);
+            next.lightMask = visibleLights;
+            spawned[h] = 1;
+        }
+    }, 256);
+    
+    // Compact the reflection queue
+    int count = 0;
+    for(int h = 0; h < hits.size(); h++) {
+        if(spawned[h]) nextPaths[count++] = nextPaths[h];
+    }
+    nextPaths.resize(count);
+}
+
+// Bounds of a set of points, padded so a flat set still gets a usable Morton grid
+static AABB pointBounds(const vector<glm::vec3>& points) {
+    AABB bounds;
+    for(const glm::vec3& p : points) bounds.extend(p);
+    bounds.min -= glm::vec3(1e-3f);
+    bounds.max += glm::vec3(1e-3f);
+    return bounds;
+}
+// Reorder the reflection paths by direction octant, then by the Morton code of their origin
+void WavefrontRenderer::sortPaths() {
+    if(paths.size() < 2) return;
+    vector<glm::vec3> origins(paths.size());
+    for(int p = 0; p < paths.size(); p++) origins[p] = paths[p].origin;
+    AABB bounds = pointBounds(origins);
+    glm::vec3 extent = bounds.extent();
+    
+    sortKeys.resize(paths.size());
+    for(int p = 0; p < paths.size(); p++) {
+        const glm::vec3& d = paths[p].direction;
+        uint64_t octant = (d.x < 0 ? 4 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 1 : 0);
+        sortKeys[p] = make_pair((octant << 30) | morton3D((origins[p] - bounds.min) / extent), p);
+    }
+    std::sort(sortKeys.begin(), sortKeys.end());
+    
+    vector<WavefrontPath> sorted(paths.size());
+    for(int k = 0; k < sortKeys.size(); k++) sorted[k] = paths[sortKeys[k].second];
+    paths.swap(sorted);
+}
+// Shadow rays toward one light are coherent already, so group by light, then by origin
+void WavefrontRenderer::sortShadowQueries() {
+    if(shadowQueries.size() < 2) return;
+    vector<glm::vec3> origins(shadowQueries.size());
+    for(int q = 0; q < shadowQueries.size(); q++) origins[q] = hits[shadowQueries[q].hit].point;
+    AABB bounds = pointBounds(origins);
+    glm::vec3 extent = bounds.extent();
+    
+    sortKeys.resize(shadowQueries.size());
+    for(int q = 0; q < shadowQueries.size(); q++) {
+        uint64_t light = shadowQueries[q].light;
+        sortKeys[q] = make_pair((light << 30) | morton3D((origins[q] - bounds.min) / extent), q);
+    }
+    std::sort(sortKeys.begin(), sortKeys.end());
+    for(int k = 0; k < sortKeys.size(); k++) shadowOrder[k] = sortKeys[k].second;
+}
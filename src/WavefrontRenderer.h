@@ -0,0 +1,89 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Primitives.h"
+#include "RenderBuffer.h"
+
+class ofApp;
+
+//  One ray in flight: a camera ray, or a reflection carrying the lights still visible along its path
+//
+struct WavefrontPath {
+    glm::vec3 origin, direction;
+    int sample;             // Slot in the wave's sample list
+    int iterations;         // Bounces left, same meaning as shade()'s iterations
+    float weight;           // Product of the reflectivities along the path
+    uint32_t seed;
+    uint64_t lightMask;     // Bit l set while light l can still contribute
+};
+//  A path that hit something, with the material looked up once for all lights
+//
+struct WavefrontHit {
+    int path;
+    int material;           // Index into the scene, hits are binned by it before shading
+    SceneObject* object;
+    glm::vec3 point, normal;
+    ofColor diffuse, specular;
+};
+//  Shadow test for one (hit, light) pair, filled in by the shadow stage
+//
+struct ShadowQuery {
+    int hit;
+    int light;
+    bool lit;               // False if the light is too far away to light the hit, only its shadow test is wanted
+    float visibility;
+    glm::vec3 direct;       // Unshadowed lambert + phong
+};
+
+/*  Breadth-first ("wavefront") version of rayTracePixel().
+ The image is cut into waves of about waveSize samples. Each stage runs over a whole wave on the
+ thread pool before the next one starts, so each loop only runs one kind of code:
+   1. generate camera rays
+   2. intersect all paths, compact the ones that hit
+   3. bin hits by material and look up their colours
+   4. emit one shadow query per hit and live light, and test them all
+   5. accumulate lighting and emit the next wave of reflection paths
+ Stage 1 takes its centre ray hits from app.primaryHit(), so they come from the rasteriser when it's on.
+ With one sample per pixel and light culling on, the wave's light clusters are built from those hits
+ and each camera path only carries its cluster's lights.
+ Steps 2-5 repeat until no paths are left. It produces the same image as the recursive renderer,
+ except intermediate sums are kept in float rather than clamped to 8 bits.
+ With sortSecondaryRays, reflection paths and shadow queries are reordered before they are traced
+ (by direction octant or light, then a Morton code of their origin), so rays that run through the
+ same part of the scene are traced back to back instead of in scattered pixel order.
+ */
+class WavefrontRenderer {
+public:
+    // Methods
+    //
+    WavefrontRenderer(ofApp& app) : app(app) {}
+    void render(RenderBuffer& buffer);
+    void render(RenderBuffer& buffer, int firstRow, int rowCount);
+    int rowsPerWave(int width);
+
+    // Variables
+    //
+    int waveSize = 1 << 16;
+    bool sortSecondaryRays = true;
+
+private:
+    void renderWave(RenderBuffer& buffer, int firstRow, int rowCount);
+    void intersectPaths(bool useCenterHits);
+    void shadeHits();
+    void sortPaths();
+    void sortShadowQueries();
+    
+    ofApp& app;
+    unordered_map<SceneObject*, int> materialIndex;
+    vector<WavefrontPath> paths;
+    vector<WavefrontPath> nextPaths;
+    vector<WavefrontHit> hits;
+    vector<WavefrontHit> centerHits;    // Primary hit through each pixel centre of the wave
+    vector<int> hitBegin;               // Per path hit index, -1 for misses
+    vector<ShadowQuery> shadowQueries;
+    vector<int> queryBegin;             // First shadow query of each hit, plus an end marker
+    vector<int> shadowOrder;            // Order the shadow queries are traced in
+    vector<pair<uint64_t, int>> sortKeys;
+    vector<glm::vec3> sampleColor;      // Running colour of every sample in the wave
+    vector<glm::vec3> clusterPoints;    // Centre hit points, for building the wave's light clusters
+};
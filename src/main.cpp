@@ -1,8 +1,46 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include <csignal>
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+static ofApp* serverApp = nullptr;
+static RenderServer* server = nullptr;
+
+// A preempted job gets SIGTERM first, stop tracing so the checkpoint is saved before exiting.
+// Between jobs there's nothing to save, so it just terminates
+static void stopServer(int signal) {
+	if(server && server->isRendering()) {
+		serverApp->cancelRender = true;
+		return;
+	}
+	std::signal(signal, SIG_DFL);
+	std::raise(signal);
+}
 
 //========================================================================
-int main( ){
+int main(int argc, char* argv[]){
+
+	// Headless render server, jobs come in on stdin (see RenderServer.h)
+	if(argc > 1 && string(argv[1]) == "--server") {
+		ofInit();
+		ofApp app;
+		serverApp = &app;
+		RenderServer renderServer(app);
+		server = &renderServer;
+#ifdef _WIN32
+		std::signal(SIGTERM, stopServer);
+#else
+		// No SA_RESTART, so a read the signal lands in fails instead of waiting for the next job
+		struct sigaction action = {};
+		action.sa_handler = stopServer;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGTERM, &action, nullptr);
+#endif
+		renderServer.run();
+		return 0;
+	}
 
 	//Use ofGLFWWindowSettings for more options like multi-monitor fullscreen
 	ofGLWindowSettings settings;
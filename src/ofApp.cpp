@@ -1,7 +1,5 @@
 #include "ofApp.h"
 
-#define SHADOWOFFSET 50
-
 // Implementation of vector reflection formula
 glm::vec3 ofApp::reflectVector(glm::vec3 incomingDirection, glm::vec3 normal) {
     glm::vec3 projection = 2 * glm::dot(incomingDirection, normal) * normal;
@@ -20,56 +18,151 @@ void ofApp::clearSelectionList() {
 SceneObject* ofApp::shortestIntersection(const Ray& r, glm::vec3& point, glm::vec3& normal) {
     SceneObject* obj = nullptr;
     float shortest = std::numeric_limits<float>::max();
-    for(int i = 0; i < scene.size(); i++) {
-        // Point and normal of each intersect() call gets stored here
-        glm::vec3 p;
-        glm::vec3 n;
-        if(scene[i]->intersect(r, p, n)) {
+    // Point and normal of each intersect() call gets stored here
+    glm::vec3 p;
+    glm::vec3 n;
+    auto test = [&](SceneObject* candidate, float& maxDistance) {
+        if(candidate->intersect(r, p, n)) {
             // If we find an intersection, check to see if it is shorter than the last stored
             float dist = glm::distance(r.position, p);
-            if(dist > 0.001f && dist < shortest) {
+            if(dist > 0.001f && dist < maxDistance) {
                 // If it's shorter, then store the intersection point, object normal, and object reference
                 point = p;
                 normal = n;
-                shortest = dist;
-                obj = scene[i];
+                maxDistance = dist;
+                obj = candidate;
             }
         }
-    }
+        return false;
+    };
+    for(auto candidate : unboundedObjects) test(candidate, shortest);
+    // Hits are compared by distance, so the hierarchy is walked with a unit length direction
+    sceneBVH.traverse(Ray(r.position, glm::normalize(r.direction)), shortest, [&](int i, float& maxDistance) {
+        return test(boundedObjects[i], maxDistance);
+    });
     return obj;
 }
 
+// First hit of a camera ray through the centre of pixel (u, v). Comes from the rasteriser's
+// visibility buffer when it's on, otherwise the ray is traced.
+SceneObject* ofApp::primaryHit(const Ray& cameraRay, int u, int v, glm::vec3& point, glm::vec3& normal) {
+    if(rasterPrimary) {
+        return rasterizer.resolve(u, v, cameraRay, point, normal);
+    }
+    return shortestIntersection(cameraRay, point, normal);
+}
+// Position of an object in the scene list, -1 if it isn't in it
+int ofApp::sceneIndex(SceneObject* obj) {
+    auto it = std::find(scene.begin(), scene.end(), obj);
+    return it == scene.end() ? -1 : it - scene.begin();
+}
 // Helper function to scale a color without altering the alpha value
 ofColor ofApp::scaleColor(ofColor color, float scale) {
     return ofColor(color.r * scale, color.g * scale, color.b * scale, color.a);
 }
-// Helper function to determine whether a ray will cause a shadow with a light
-bool ofApp::isShadow(const Ray& shadowRay, BaseLight& light) {
-    if(light.getIntensity(&shadowRay) == 0.0) { // This is mostly for spotlight, check if ray is within spotlight bound
-        return true;
-    }
+// Helper function to determine whether anything blocks a shadow ray before it reaches the light
+bool ofApp::isShadow(const Ray& shadowRay, float distanceToLight) {
     glm::vec3 intersectionPoint; // Placeholder variables to store function results
     glm::vec3 intersectionNormal;
+    // If we find an intersection with the shadow ray and its between the obj and the light
+    auto blocks = [&](SceneObject* obj) {
+        return obj->intersect(shadowRay, intersectionPoint, intersectionNormal) && glm::distance(intersectionPoint, shadowRay.position) < distanceToLight;
+    };
     
-    /*
-     Two reasons for things to be in shadow:
-     1. There's an object between the light and the intersection point
-     2. We have a spotlight, and the angle between the light normal and the shadow ray is greater than the light angle
-     */
+    for(auto obj : unboundedObjects) {
+        if(blocks(obj)) return true;
+    }
+    bool shadowed = false;
+    float maxDistance = distanceToLight;
+    sceneBVH.traverse(Ray(shadowRay.position, glm::normalize(shadowRay.direction)), maxDistance, [&](int i, float&) {
+        shadowed = blocks(boundedObjects[i]);
+        return shadowed;
+    });
+    return shadowed;
+}
+// Hierarchy over the scene for shortestIntersection() and isShadow(). Anything can move between
+// renders and a scene is a handful of objects, so it's rebuilt every time rather than refitted.
+void ofApp::buildSceneBVH() {
+    boundedObjects.clear();
+    unboundedObjects.clear();
+    vector<AABB> bounds;
+    for(auto obj : scene) {
+        AABB box = obj->getBounds();
+        if(box.isEmpty()) {
+            unboundedObjects.push_back(obj);
+        } else {
+            boundedObjects.push_back(obj);
+            bounds.push_back(box);
+        }
+    }
+    sceneBVH.build(bounds, sceneBVHMethod);
+}
+// Per frame setup every render path does before tracing a width pixel wide image
+void ofApp::prepareScene(int width) {
+    prepareSceneData();
+    setPixelFootprint(width);
+}
+// The part of prepareScene() that doesn't depend on the camera, the multi-view renderer does it
+// once for all its views and sets the pixel footprint itself
+void ofApp::prepareSceneData() {
+    buildSceneBVH();
+    if(useShadowMaps) shadowMaps.build(scene, sceneLights, ThreadPool::shared());
+    lightClusters.setLights(sceneLights, 255 * (diffuseCoefficient + specularCoefficient));
+}
+// How fast a pixel of a width pixel wide render grows with distance from the camera. Each texture
+// lookup scales it by how far its ray went, so near and far parts of a plane get their own mip level
+void ofApp::setPixelFootprint(int width) {
+    float focal = std::max(std::abs(renderCam.position.z - renderCam.view.position.z), 1e-6f);
+    pixelSize = 0;
+    pixelAngle = renderCam.view.width() / (focal * width);
+}
+/*
+ Fraction of a light visible from origin, 0 is fully in shadow and 1 is fully lit.
+ Two reasons for things to be in shadow:
+ 1. There's an object between the light and the intersection point
+ 2. We have a spotlight, and the angle between the light normal and the shadow ray is greater than the light angle
+ Lights are spheres of lightRadius. We sample the disk they cover with shadowSamples scrambled Sobol
+ points, and stop after the first 4 when they all agree, so only penumbra pixels pay for every sample.
+ With shadow maps on, the light's map answers instead wherever it covers origin.
+ */
+float ofApp::shadowVisibility(const glm::vec3& origin, BaseLight& light, uint32_t seed) {
+    glm::vec3 toLight = light.position - origin;
+    float distanceToLight = glm::length(toLight);
+    Ray centerRay = Ray(origin, toLight / distanceToLight);
+    if(light.getIntensity(&centerRay) == 0.0) { // This is mostly for spotlight, check if ray is within spotlight bound
+        return 0.0f;
+    }
+    if(useShadowMaps) {
+        float visibility = shadowMaps.visibility(light, origin);
+        if(visibility >= 0) return visibility;      // Otherwise off the light's map, trace it
+    }
+    if(shadowSamples <= 1 || light.lightRadius <= 0) {
+        return isShadow(centerRay, distanceToLight) ? 0.0f : 1.0f;
+    }
     
-    float distanceToLight = glm::abs(glm::distance(shadowRay.position, light.position));
-    for(int i = 0; i < scene.size(); i++) {
-        if(scene[i]->intersect(shadowRay, intersectionPoint, intersectionNormal)) { // If we find an intersection with the shadow ray
-            if(glm::distance(intersectionPoint, shadowRay.position) < distanceToLight) { // And its between the obj and the light
-                return true;
-            }
+    // Basis for the disk of the light facing the shading point
+    glm::vec3 w = centerRay.direction;
+    glm::vec3 helper = glm::abs(w.x) > 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+    glm::vec3 u = glm::normalize(glm::cross(helper, w));
+    glm::vec3 v = glm::cross(w, u);
+    
+    int firstPass = std::min(4, shadowSamples);
+    int lit = 0;
+    for(int i = 0; i < shadowSamples; i++) {
+        glm::vec2 disk = concentricDisk(sobol2D(i, seed)) * light.lightRadius;
+        glm::vec3 toSample = light.position + u * disk.x + v * disk.y - origin;
+        float distanceToSample = glm::length(toSample);
+        if(!isShadow(Ray(origin, toSample / distanceToSample), distanceToSample)) lit++;
+        
+        if(i + 1 == firstPass && (lit == 0 || lit == firstPass)) {
+            return lit == 0 ? 0.0f : 1.0f;
         }
     }
-    return false;
+    return float(lit) / shadowSamples;
 }
 
 // Base function for raytracing
-ofColor ofApp::shade(const Ray& incomingRay, BaseLight& light, int iterations) {
+ofColor ofApp::shade(const Ray& incomingRay, BaseLight& light, int iterations, uint32_t seed) {
     // Start with a base color to be added onto with shading algorithm
     ofColor shadedColor = ofColor(0, 0, 0);
     if(iterations == 0) {
@@ -78,39 +171,66 @@ ofColor ofApp::shade(const Ray& incomingRay, BaseLight& light, int iterations) {
     // Check for intersection with this ray and any objects in the scene
     glm::vec3 intersectionPoint, intersectionNormal;
     SceneObject* intersectedObject = shortestIntersection(incomingRay, intersectionPoint, intersectionNormal);
-    if(intersectedObject == nullptr) {
+    return shadeHit(incomingRay, intersectedObject, intersectionPoint, intersectionNormal, light, iterations, seed);
+}
+// Rest of shade() once the ray's hit is known, so hits found some other way can be shaded too
+ofColor ofApp::shadeHit(const Ray& incomingRay, SceneObject* intersectedObject, const glm::vec3& intersectionPoint, const glm::vec3& intersectionNormal, BaseLight& light, int iterations, uint32_t seed) {
+    ofColor shadedColor = ofColor(0, 0, 0);
+    if(iterations == 0 || intersectedObject == nullptr) {
+        return shadedColor;
+    }
+    // A light too far away to add anything visible is skipped, unless the hit needs every light's shadow test
+    bool reaches = lightReaches(intersectedObject, intersectionPoint, light);
+    if(!reaches && !needsAllLights(intersectedObject, iterations)) {
         return shadedColor;
     }
-    // Create a ray originating from the intersection point (offset slightly for floating point error), pointing toward the light to detect shadows
-    Ray* shadowRay = new Ray(intersectionPoint + intersectionNormal / SHADOWOFFSET, glm::normalize(light.position - intersectionPoint));
-    if(isShadow(*shadowRay, light)) {
-        delete shadowRay;
+    // Shadow rays start from the intersection point (offset slightly for floating point error) toward the light
+    float visibility = shadowVisibility(intersectionPoint + intersectionNormal / SHADOWOFFSET, light, seed);
+    if(visibility == 0.0f) {
         return shadedColor;
     }
-    delete shadowRay; // No shadow, calculate color value using specular and diffuse lighitng
+    // Not fully in shadow, calculate color value using specular and diffuse lighitng
     
     // this mess is because i added on cel shading at the end of my project lmao
-    shadedColor += lambert(intersectionPoint, intersectionNormal, intersectedObject->getDiffuseColor(intersectionPoint), light, intersectedObject->celShaded);
-    if(!intersectedObject->celShaded) {
-        shadedColor += phong(incomingRay, intersectionPoint, intersectionNormal, intersectedObject->getSpecularColor(intersectionPoint), phongPower, light);
+    if(reaches) {
+        float footprint = pixelFootprint(incomingRay.position, intersectionPoint);
+        ofColor directColor = lambert(intersectionPoint, intersectionNormal, intersectedObject->getDiffuseColor(intersectionPoint, footprint), light, intersectedObject->celShaded);
+        if(!intersectedObject->celShaded) {
+            directColor += phong(incomingRay, intersectionPoint, intersectionNormal, intersectedObject->getSpecularColor(intersectionPoint, footprint), phongPower, light);
+        }
+        shadedColor += scaleColor(directColor, visibility);
     }
     
     glm::vec3 reflection = reflectVector(incomingRay.direction, intersectionNormal);
     Ray* bounceRay = new Ray(intersectionPoint, reflection);
-    shadedColor += shade(*bounceRay, light, iterations - 1) * intersectedObject->reflectivity;
+    shadedColor += shade(*bounceRay, light, iterations - 1, hashSeed(seed)) * intersectedObject->reflectivity;
     
     delete bounceRay;
     return shadedColor;
 }
+// Whether light can add anything visible at point on obj. Cel shading puts a floor under the
+// lambert term however far the light is, so cel shaded objects are reached by every light
+bool ofApp::lightReaches(SceneObject* obj, const glm::vec3& point, BaseLight& light) {
+    return obj->celShaded || lightClusters.reaches(light, point);
+}
+// Whether shading a hit on obj needs every light, and not just the ones that reach it: cel shaded
+// objects, and hits that reflect, as a light's reflection only carries on from hits outside its shadow
+bool ofApp::needsAllLights(SceneObject* obj, int iterations) {
+    return obj->celShaded || (iterations > 1 && obj->reflectivity > 0);
+}
 // Ambient Lighting, adds a baseline intensity to the color.
 ofColor ofApp::ambient(const Ray& incomingRay) {
-    ofColor diffuse;
     glm::vec3 intersectionPoint, intersectionNormal;
     SceneObject* intersectedObject = shortestIntersection(incomingRay, intersectionPoint, intersectionNormal);
-    if(intersectedObject == nullptr) {
+    return ambientColor(intersectedObject, intersectionPoint, pixelFootprint(incomingRay.position, intersectionPoint));
+}
+// Ambient term for an already found primary hit, obj is nullptr if the ray hit nothing
+ofColor ofApp::ambientColor(SceneObject* obj, const glm::vec3& point, float footprint) {
+    ofColor diffuse;
+    if(obj == nullptr) {
         diffuse = ofColor::lightGrey;
     } else {
-        diffuse = intersectedObject->getDiffuseColor(intersectionPoint);
+        diffuse = obj->getDiffuseColor(point, footprint);
     }
     float intensity =  ambientLightSlider / 255;
     ofColor ambientColor = ofColor(diffuse.r * intensity, diffuse.g * intensity, diffuse.b * intensity, diffuse.r);
@@ -206,68 +326,422 @@ void ofApp::drawGrid() {
         v += pixelHeight;
     }
 }
-bool ofApp::outlinePass(Ray& cameraRay) {
-    Ray* outlineRay = new Ray(cameraRay.position, glm::normalize(renderCam.aim));
-    glm::vec3 intersectionPoint, intersectionNormal;
-    SceneObject* intersectedObject = shortestIntersection(cameraRay, intersectionPoint, intersectionNormal);
-    if(intersectedObject == nullptr) {
-        return false;
+// Trace one pixel of the view plane, (0, 0) being the bottom left corner. The pixel has to be
+// in the band of rows the buffer holds. Camera rays come from view instead of renderCam if it's
+// given. Averages samplesPerPixel jittered camera rays, and records the primary hit through the
+// pixel centre (albedo, normal, depth, object) for the post passes.
+void ofApp::rayTracePixel(RenderBuffer& buffer, const int u, const int v, const ViewCamera* view) {
+    glm::vec3 point, normal;
+    SceneObject* obj = tracePrimary(buffer, u, v, view, point, normal);
+    shadePixel(buffer, u, v, view, obj, point, normal);
+}
+// First half of rayTracePixel(): the hit through the pixel centre, written to the feature buffers
+SceneObject* ofApp::tracePrimary(RenderBuffer& buffer, const int u, const int v, const ViewCamera* view, glm::vec3& point, glm::vec3& normal) {
+    int i = buffer.index(u, buffer.imageHeight - 1 - v - buffer.firstRow);
+    Ray centerRay = view ? view->getRay(float(u + 0.5) / buffer.width, float(v + 0.5) / buffer.imageHeight)
+                         : renderCam.getRay(float(u + 0.5) / buffer.width, float(v + 0.5) / buffer.imageHeight);  // getRay uses normalized coordinates, so we need to offset the pixel to the center as well as divide it by the image dimension
+    SceneObject* obj = view ? shortestIntersection(centerRay, point, normal) : primaryHit(centerRay, u, v, point, normal);
+    if(obj != nullptr) {
+        ofColor diffuse = obj->getDiffuseColor(point, pixelFootprint(centerRay.position, point));
+        buffer.albedo[i] = glm::vec3(diffuse.r, diffuse.g, diffuse.b) / 255.0f;
+        buffer.normal[i] = normal;
+        buffer.depth[i] = glm::distance(centerRay.position, point);
+        buffer.objectId[i] = sceneIndex(obj);
     }
-    // just gonna hard code out planes.frick planes.
-    Sphere* sphere = dynamic_cast<Sphere*>(intersectedObject);
-    if(!sphere) return false;
-    float angle = glm::abs(glm::dot(intersectionNormal, cameraRay.direction));
-    if(angle < 0.30) {
-        return true;
+    return obj;
+}
+// Second half: the pixel's colour, given its centre hit. With one sample per pixel, lights is
+// which of sceneLights can reach the centre hit, used unless the hit needs them all (see needsAllLights())
+void ofApp::shadePixel(RenderBuffer& buffer, const int u, const int v, const ViewCamera* view, SceneObject* obj, const glm::vec3& point, const glm::vec3& normal,
+                       const vector<int>* lights) {
+    int width = buffer.width;
+    int height = buffer.imageHeight;
+    int i = buffer.index(u, height - 1 - v - buffer.firstRow);
+    if(obj != nullptr && reuseHistory && !view && reprojection.reuse(i, point, normal, buffer.objectId[i], renderCam.position, buffer.color[i], buffer.variance[i])) {
+        return;
     }
-    return false;
+    uint32_t seed = pixelSeed(u, v);
+    auto getRay = [this, view](float s, float t) { return view ? view->getRay(s, t) : renderCam.getRay(s, t); };
+    Ray centerRay = getRay(float(u + 0.5) / width, float(v + 0.5) / height);
+
+    glm::vec3 colorSum = glm::vec3(0, 0, 0);
+    float luminanceSum = 0;
+    float luminanceSquaredSum = 0;
+    for(int s = 0; s < samplesPerPixel; s++) {
+        Ray cameraRay = centerRay;
+        if(samplesPerPixel > 1) {
+            glm::vec2 jitter = sobol2D(s, seed ^ 0x5bd1e995u);
+            cameraRay = getRay((u + jitter.x) / width, (v + jitter.y) / height);
+        }
+        uint32_t sampleSeed = hashSeed(seed + s);
+        
+        ofColor totalColor;
+        if(samplesPerPixel == 1) {
+            // The only sample is the centre ray, whose hit is already known
+            totalColor = ambientColor(obj, point, pixelFootprint(cameraRay.position, point));
+            if(lights && obj && !needsAllLights(obj, lightBounces)) {
+                for(int l : *lights) totalColor += shadeHit(cameraRay, obj, point, normal, *sceneLights[l], lightBounces, sampleSeed);
+            } else {
+                for(int l = 0; l < sceneLights.size(); l++) {
+                    totalColor += shadeHit(cameraRay, obj, point, normal, *sceneLights[l], lightBounces, sampleSeed);
+                }
+            }
+        } else {
+            totalColor = ambient(cameraRay);
+            for(int l = 0; l < sceneLights.size(); l++) {
+                totalColor += shade(cameraRay, *sceneLights[l], lightBounces, sampleSeed) ;
+            }
+        }
+        glm::vec3 color = glm::vec3(totalColor.r, totalColor.g, totalColor.b);
+        float luminance = 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+        colorSum += color;
+        luminanceSum += luminance;
+        luminanceSquaredSum += luminance * luminance;
+    }
+    float mean = luminanceSum / samplesPerPixel;
+    buffer.color[i] = colorSum / float(samplesPerPixel);
+    buffer.variance[i] = std::max(0.0f, luminanceSquaredSum / samplesPerPixel - mean * mean) / samplesPerPixel; // Variance of the mean
 }
-void ofApp::rayTrace(ofImage& img) {
+void ofApp::rayTrace(ofPixels& pixels) {
     /* For each pixel of our view plane:
      1. Cast a ray from our camera to that pixel
      2. Check intersection with all objects
      3. Get object that has the shortest distance
      4. Shade pixel in image to that object's color
+     The float buffer is optionally denoised and outlined before being written into pixels.
+     If only some objects changed since the last frame, just the pixels they can affect are traced.
+     If only the camera moved and reprojection is on, pixels still showing what they showed last
+     frame reuse its shading.
      */
-    for(int u = 0; u < img.getWidth(); u++) {
-        for(int v = 0; v < img.getHeight(); v++) {
+    int width = pixels.getWidth();
+    int height = pixels.getHeight();
+    glm::ivec4 region;
+    if(edits.dirtyRegion(scene, sceneLights, renderCam, width, height, renderSettings(), lightBounces > 1, region)) {
+        if(renderStarted) renderStarted(size_t(std::max(0, region.z - region.x + 1)) * std::max(0, region.w - region.y + 1));
+        renderRegion(region);
+    } else {
+        if(renderStarted) renderStarted(size_t(width) * height);
+        reuseHistory = reprojectCamera && reprojection.isValid() && edits.sameScene(scene, sceneLights, width, height, renderSettings());
+        renderBand(renderBuffer, width, height, 0, height);
+        reuseHistory = false;
+    }
+    if(cancelRender) {
+        edits.invalidate();     // renderBuffer is half traced
+        reprojection.invalidate();
+        return;
+    }
+    edits.record(scene, sceneLights, renderCam, width, height, renderSettings());
+    if(reprojectCamera) reprojection.store(renderBuffer, tracedColor, renderCam, ThreadPool::shared());
+    renderBuffer.toPixels(pixels);
+}
+// Trace the pixels in region (view plane pixels, inclusive) of the frame already in renderBuffer again, in tiles.
+// Each tile goes to tileDone when it's finished
+void ofApp::renderRegion(const glm::ivec4& region) {
+    if(region.x > region.z || region.y > region.w) return;     // Nothing changed
+    RenderBuffer& buffer = renderBuffer;
+    prepareScene(buffer.width);
+    if(rasterPrimary) {
+        rasterizer.rasterize(scene, renderCam, buffer.width, buffer.imageHeight, ThreadPool::shared());
+    }
+    buffer.color = tracedColor;
+    if(reprojectCamera) reprojection.beginFrame(buffer.width, buffer.height, false);
+
+    const int tileSize = 32;
+    int tilesX = (region.z - region.x + tileSize) / tileSize;
+    int tilesY = (region.w - region.y + tileSize) / tileSize;
+    ThreadPool::shared().parallelFor(tilesX * tilesY, [this, &buffer, &region, tilesX, tileSize](int tile) {
+        int u0 = region.x + (tile % tilesX) * tileSize;
+        int v0 = region.y + (tile / tilesX) * tileSize;
+        int u1 = std::min(region.z, u0 + tileSize - 1);
+        int v1 = std::min(region.w, v0 + tileSize - 1);
+        for(int v = v0; v <= v1; v++) {
+            for(int u = u0; u <= u1; u++) {
+                if(cancelRender) return;
+                buffer.clearPixel(buffer.index(u, buffer.imageHeight - 1 - v));
+                reprojection.markTraced(buffer.index(u, buffer.imageHeight - 1 - v));
+                rayTracePixel(buffer, u, v);
+            }
+        }
+        if(tileDone) tileDone(glm::ivec4(u0, buffer.imageHeight - 1 - v1, u1 - u0 + 1, v1 - v0 + 1));
+    });
+    if(cancelRender) return;
 
-            Ray cameraRay = renderCam.getRay(float(u + 0.5) / img.getWidth(), float(v + 0.5) / img.getHeight());  // getRay uses normalized coordinates, so we need to offset the pixel to the center as well as divide it by the image dimension
+    tracedColor = buffer.color;
+    if(denoise) {
+        denoiser.denoise(buffer, ThreadPool::shared());
+    }
+    outlines.apply(buffer, ThreadPool::shared());
+}
+// Hash of everything besides the scene, lights and camera that goes into a frame
+uint64_t ofApp::renderSettings() {
+    uint64_t hash = hashBytes(&diffuseCoefficient, sizeof(float));
+    for(float value : {specularCoefficient, ambientLight, phongPower, lightClusters.cutoff}) hash = hashBytes(&value, sizeof(value), hash);
+    for(int value : {lightBounces, shadowSamples, samplesPerPixel, (int)denoise, (int)useWavefront, (int)rasterPrimary,
+                     (int)wavefront.sortSecondaryRays, (int)sceneBVHMethod, denoiser.iterations, outlines.thickness, (int)reprojectCamera,
+                     (int)useShadowMaps, shadowMaps.resolution}) {
+        hash = hashBytes(&value, sizeof(value), hash);
+    }
+    return hash;
+}
+// Render rows [firstRow, firstRow + rowCount) (top to bottom) of a width x imageHeight image into buffer.
+// Rows are traced a strip at a time, handing each strip's columns out to the thread pool, so every
+// pixel is written by exactly one thread. Finished strips go to tileDone, in buffer rows.
+void ofApp::renderBand(RenderBuffer& buffer, int width, int imageHeight, int firstRow, int rowCount) {
+    buffer.allocate(width, rowCount, imageHeight, firstRow);
+    prepareScene(width);
+    if(rasterPrimary) {
+        rasterizer.rasterize(scene, renderCam, width, imageHeight, ThreadPool::shared(), imageHeight - firstRow - rowCount, rowCount);
+    }
+    if(reprojectCamera && &buffer == &renderBuffer && rowCount == imageHeight) reprojection.beginFrame(width, rowCount, true);
+    // Wavefront paths track live lights in a 64 bit mask, and don't reuse reprojected pixels
+    bool useWaves = useWavefront && sceneLights.size() <= 64 && !reuseHistory;
+    int stripRows = wavefront.rowsPerWave(width);      // About a wave's worth of samples either way
 
-            if(outlinePass(cameraRay)) {
-                img.setColor(u, img.getHeight() - 1 - v, ofColor::black);
-            } else {
-                ofColor totalColor = ambient(cameraRay);
-                for(int i = 0; i < sceneLights.size(); i++) {
-                    totalColor += shade(cameraRay, *sceneLights[i], lightBounces) ;
+    // Pick up where a crashed or cancelled render of the same frame left off
+    bool checkpointing = checkpointRenders && &buffer == &renderBuffer && rowCount == imageHeight && !reuseHistory;
+    int rowsDone = 0;
+    if(checkpointing) {
+        rowsDone = checkpoint.open(checkpointPath, edits.frameHash(scene, sceneLights, renderCam, width, imageHeight, renderSettings(), sceneContent), buffer);
+        if(rowsDone > 0) {
+            cout << "Resuming from row " << rowsDone << " of " << rowCount << endl;
+            if(tileDone) tileDone(glm::ivec4(0, 0, width, rowsDone));
+        }
+    }
+    for(int row = rowsDone; row < rowCount && !cancelRender; row += stripRows) {
+        int rows = std::min(stripRows, rowCount - row);
+        if(useWaves) {
+            wavefront.render(buffer, row, rows);
+        } else if(samplesPerPixel == 1 && lightClusters.isEnabled()) {
+            // Centre hits for the whole strip first, so its light clusters can be built from their depths
+            int pixels = width * rows;
+            stripObjects.resize(pixels);
+            stripPoints.resize(pixels);
+            stripNormals.resize(pixels);
+            ThreadPool::shared().parallelFor(width, [&](int u) {
+                for(int y = row; y < row + rows; y++) {
+                    if(cancelRender) return;
+                    int p = (y - row) * width + u;
+                    stripObjects[p] = tracePrimary(buffer, u, buffer.viewRow(y), nullptr, stripPoints[p], stripNormals[p]);
                 }
-                img.setColor(u, img.getHeight() - 1 - v, totalColor);
+            }, 8);
+            if(cancelRender) break;
+            lightClusters.build(stripPoints.data(), &buffer.depth[buffer.index(0, row)], width, rows, ThreadPool::shared());
+            ThreadPool::shared().parallelFor(width, [&](int u) {
+                for(int y = row; y < row + rows; y++) {
+                    if(cancelRender) return;
+                    int p = (y - row) * width + u;
+                    shadePixel(buffer, u, buffer.viewRow(y), nullptr, stripObjects[p], stripPoints[p], stripNormals[p], &lightClusters.lightsAt(u, y - row));
+                }
+            }, 8);
+        } else {
+            ThreadPool::shared().parallelFor(width, [this, &buffer, row, rows](int u) {
+                for(int y = row; y < row + rows; y++) {
+                    if(cancelRender) return;
+                    rayTracePixel(buffer, u, buffer.viewRow(y));
+                }
+            }, 8);
+        }
+        if(tileDone && !cancelRender) tileDone(glm::ivec4(0, row, width, rows));
+        if(cancelRender) break;
+        rowsDone = row + rows;
+        if(checkpointing) checkpoint.update(buffer, rowsDone);
+    }
+    if(cancelRender) {
+        if(checkpointing) checkpoint.save(buffer, rowsDone);
+        return;
+    }
+    if(checkpointing) checkpoint.finish();
+
+    if(&buffer == &renderBuffer && rowCount == imageHeight) tracedColor = buffer.color;
+    if(denoise) {
+        denoiser.denoise(buffer, ThreadPool::shared());
+    }
+    outlines.apply(buffer, ThreadPool::shared());
+}
+/* Render a width x height image straight to a binary PPM, a band of rows at a time, so a print size
+ render never needs the whole frame in memory. Bands are about streamBandPixels pixels. Each band is
+ traced with an apron of the rows the denoiser and outlines read past its edges, so the rows written
+ out come out the same as in a full frame render. Bands are at least four aprons tall, so at wide
+ print sizes the aprons add at most half again to the rows traced.
+ Band k - 1 is written to disk while band k is traced. With checkpointing on, a cancelled or crashed
+ stream keeps the rows already on disk, and the next render of the same frame to the path goes on from there.
+ */
+bool ofApp::renderStreaming(const string& path, int width, int height) {
+    ImageStream stream;
+    int firstRow = 0;
+    if(checkpointRenders) {
+        // Same frame as an abandoned stream to this path: keep its rows and trace the rest
+        firstRow = stream.resume(path, width, height, edits.frameHash(scene, sceneLights, renderCam, width, height, renderSettings(), sceneContent));
+        if(firstRow > 0) cout << "Resuming from row " << firstRow << " of " << height << endl;
+    } else if(!stream.open(path, width, height)) {
+        firstRow = -1;
+    }
+    if(firstRow < 0) {
+        cout << "Could not open " << path << endl;
+        return false;
+    }
+    edits.invalidate();     // renderBuffer only ever holds a band
+    reprojection.invalidate();
+    int apron = std::max(denoise ? denoiser.radius() : 0, outlines.thickness);
+    int bandRows = std::max({1, 4 * apron, streamBandPixels / width});
+    for(int row = firstRow; row < height; row += bandRows) {
+        int rows = std::min(bandRows, height - row);
+        int first = std::max(0, row - apron);
+        int last = std::min(height, row + rows + apron);
+        renderBand(renderBuffer, width, height, first, last - first);
+        if(cancelRender) {
+            if(checkpointRenders) {
+                stream.abandon();       // Kept with its progress file for the next render of the frame
+            } else {
+                stream.close();
+                std::remove(ofToDataPath(path).c_str());    // Half an image, don't leave it looking finished
             }
+            return false;
         }
+        stream.writeRows(renderBuffer, row - first, rows);
+        cout << "rows " << row + rows << "/" << height << endl;
     }
+    return stream.close();
+}
+/* Render cam plus the side and top views as orthographic cameras, in one multi-view job.
+ Saved as baseName_hero.jpg, baseName_side.jpg and baseName_top.jpg. */
+bool ofApp::renderViews(const string& baseName, int width, int height) {
+    float aspect = float(width) / height;
+    vector<ViewCamera> views = {
+        ViewCamera::fromRenderCam(renderCam),
+        ViewCamera::orthographic(sideCam.getPosition(), glm::vec3(0, 0, 0), 20, aspect),
+        ViewCamera::orthographic(topCam.getPosition(), glm::vec3(0, 0, 0), 20, aspect, glm::vec3(0, 0, -1))
+    };
+    vector<string> names = {"hero", "side", "top"};
+    vector<ofPixels> images(views.size());
+    for(auto& pixels : images) pixels.allocate(width, height, OF_IMAGE_COLOR);
+    if(!multiView.render(views, images)) return false;
+    for(int i = 0; i < images.size(); i++) {
+        ofSaveImage(images[i], baseName + "_" + names[i] + ".jpg");
+    }
+    return true;
+}
+void ofApp::rayTrace(ofImage& img) {
+    rayTrace(img.getPixels());
+    
     // Update img and save to disk
     img.update();
     img.save("render.jpg");
 }
+// Move the camera, objects and lights to where the sequence puts them for this frame
+void ofApp::applyFrameState(const FrameState& state) {
+    if(state.hasCamera) {
+        renderCam.setPosition(state.cameraPosition);
+        renderCam.setAim(state.cameraAim);
+    }
+    for(auto& key : state.objectPositions) {
+        if(key.first >= 0 && key.first < scene.size()) scene[key.first]->position = key.second;
+    }
+    for(auto& key : state.lightPositions) {
+        if(key.first >= 0 && key.first < sceneLights.size()) sceneLights[key.first]->position = key.second;
+    }
+}
+/* Render every frame of a sequence to a numbered image in sequence.outputDirectory.
+ Frames are pipelined so the pool never waits between them:
+  - the keyframes of frame k + 1 are evaluated while frame k is traced
+  - frame k - 1 is encoded and written to disk while frame k is traced
+ Only applying the evaluated state touches the scene, which happens between traces.
+ */
+void ofApp::renderSequence(AnimationSequence& sequence) {
+    if(sequence.frameCount <= 0) return;
+    ofDirectory::createDirectory(sequence.outputDirectory, true, true);
+    
+    // Restore the still's camera and transforms once the sequence is done
+    RenderCam savedCam = renderCam;
+    vector<glm::vec3> savedObjects, savedLights;
+    for(auto obj : scene) savedObjects.push_back(obj->position);
+    for(auto light : sceneLights) savedLights.push_back(light->position);
+    
+    ofPixels frames[2];     // Frame k is traced into one buffer while frame k - 1 is encoded from the other
+    std::future<bool> encoding;
+    std::future<FrameState> nextState = std::async(std::launch::async, [&sequence] { return sequence.evaluate(0); });
+    
+    for(int frame = 0; frame < sequence.frameCount; frame++) {
+        applyFrameState(nextState.get());
+        if(frame + 1 < sequence.frameCount) {
+            nextState = std::async(std::launch::async, [&sequence, frame] { return sequence.evaluate(frame + 1); });
+        }
+        
+        ofPixels& pixels = frames[frame % 2];
+        pixels.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+        rayTrace(pixels);
+        
+        // Frame k - 1 has had the whole trace to finish encoding, its buffer gets reused next frame
+        if(encoding.valid()) encoding.get();
+        string path = sequence.framePath(frame);
+        encoding = std::async(std::launch::async, [&pixels, path] { return ofSaveImage(pixels, path); });
+        cout << "frame " << frame + 1 << "/" << sequence.frameCount << endl;
+    }
+    if(encoding.valid()) encoding.get();
+    
+    renderCam = savedCam;
+    for(int i = 0; i < scene.size(); i++) scene[i]->position = savedObjects[i];
+    for(int i = 0; i < sceneLights.size(); i++) sceneLights[i]->position = savedLights[i];
+}
 void ofApp::addPointLightButtonPressed() {
+    if(background.isRunning()) return;
     sceneLights.push_back(new PointLight(glm::vec3(0, 5, 0), 100, ofColor::white));
 }
 void ofApp::addSphereButtonPressed() {
+    if(background.isRunning()) return;
     scene.push_back(new Sphere(glm::vec3(0, 0, 0), 1, ofColor::white, false));
 }
+// Render parameters with their defaults and ranges. Split out of guiSetup() so the render server,
+// which has no window or GUI, starts from the same values
+void ofApp::parameterSetup() {
+    renderParamGuiLabel.set("Render Parameters");
+    diffuseCoefficientSlider.set("Diffuse Coefficient", 0.05, 0, 1.0);
+    specularCoefficientSlider.set("Specular Coefficient", 0.05, 0, 1.0);
+    ambientLightSlider.set("Ambient Light", 80, 0, 255);
+    phongPowerSlider.set("Phong Exponent", 20, 1, 64);
+    lightBounceSlider.set("Light Bounces", 2, 1, 5);
+    shadowSamplesSlider.set("Shadow Samples", 16, 1, 64);
+    samplesPerPixelSlider.set("Samples Per Pixel", 1, 1, 64);
+    denoiseToggle.set("Denoise", false);
+    wavefrontToggle.set("Wavefront", false);
+    sortRaysToggle.set("Sort Secondary Rays", true);
+    rasterToggle.set("Raster Primary Hits", false);
+    lbvhToggle.set("Fast Scene BVH (LBVH)", false);
+    outlineThicknessSlider.set("Outline Thickness", 1, 0, 8);
+    reprojectToggle.set("Reproject Camera Moves", false);
+    shadowMapToggle.set("Shadow Maps (Preview)", false);
+    shadowMapSizeSlider.set("Shadow Map Size", 256, 64, 2048);
+    checkpointToggle.set("Checkpoint Renders", false);
+    lightCutoffSlider.set("Light Cutoff", 0.5, 0, 8);
+    printWidthSlider.set("Print Width", 2400, 600, 32768);
+}
 // For organization. Put renderParamGui setup stuff here
 void ofApp::guiSetup() {
     renderParamGui.clear();
     renderParamGui.setup();
     renderParamGui.setPosition(ofGetWidth() - 200, 50);
     
-    renderParamGuiLabel.set("Render Parameters");
+    parameterSetup();
     renderParamGui.add(renderParamGuiLabel);
-    renderParamGui.add(diffuseCoefficientSlider.set("Diffuse Coefficient", 0.05, 0, 1.0));
-    renderParamGui.add(specularCoefficientSlider.set("Specular Coefficient", 0.05, 0, 1.0));
-    renderParamGui.add(ambientLightSlider.set("Ambient Light", 80, 0, 255));
-    renderParamGui.add(phongPowerSlider.set("Phong Exponent", 20, 1, 64));
-    renderParamGui.add(lightBounceSlider.set("Light Bounces", 2, 1, 5));
+    renderParamGui.add(diffuseCoefficientSlider);
+    renderParamGui.add(specularCoefficientSlider);
+    renderParamGui.add(ambientLightSlider);
+    renderParamGui.add(phongPowerSlider);
+    renderParamGui.add(lightBounceSlider);
+    renderParamGui.add(shadowSamplesSlider);
+    renderParamGui.add(samplesPerPixelSlider);
+    renderParamGui.add(denoiseToggle);
+    renderParamGui.add(wavefrontToggle);
+    renderParamGui.add(sortRaysToggle);
+    renderParamGui.add(rasterToggle);
+    renderParamGui.add(lbvhToggle);
+    renderParamGui.add(outlineThicknessSlider);
+    renderParamGui.add(reprojectToggle);
+    renderParamGui.add(shadowMapToggle);
+    renderParamGui.add(shadowMapSizeSlider);
+    renderParamGui.add(checkpointToggle);
+    renderParamGui.add(lightCutoffSlider);
+    renderParamGui.add(printWidthSlider);
     
     objectGui.clear();
     objectGui.setup();
@@ -301,23 +775,30 @@ void ofApp::cameraSetup() {
     theCam = &mainCam;
 }
 void ofApp::objectSetup() {
+    // Textures are converted to tiled files in parallel on the thread pool (first run only) while the rest of the scene is set up.
+    // Plane colours are then paged in tile by tile from the texture cache
+    auto woodfloor = assets.loadCachedTexture("woodfloor/woodfloor.jpg");
+    auto woodfloorSpecular = assets.loadCachedTexture("woodfloor/woodfloor_spec.jpg");
+    auto floral = assets.loadCachedTexture("floral/floral.jpg");
+    auto floralSpecular = assets.loadCachedTexture("floral/floral_spec.jpg");
+    
     // Initialize objects in the scene
     // Mesh scene.push_back(new Mesh(glm::vec3(4, -1, -5), ofColor::gray, "polygon.obj"));
+    // Out of core mesh, convert once: OutOfCoreMesh::convert("scan.obj", "scan.ooc");
+    // scene.push_back(new OutOfCoreMesh(glm::vec3(0, 0, 0), ofColor::gray, "scan.ooc"));
+    // Particle dump from a simulation, millions of spheres as one object:
+    // scene.push_back(new ParticleSet("particles.bin"));
     scene.push_back(new Sphere(glm::vec3(2, 1, -8), 2, ofColor(168, 220, 255), 0.2f, true));
     scene.push_back(new Sphere(glm::vec3(-2, 0, -8), 1.5, ofColor(168, 220, 205), 0.2f, true));
     scene.push_back(new Sphere(glm::vec3(-1, 0, -8), 1, ofColor::grey, 0.5f));
 
     // Planes
-    textures.push_back(new ofImage("woodfloor/woodfloor.jpg"));
-    textures.push_back(new ofImage("woodfloor/woodfloor_spec.jpg"));
-    
-    textures.push_back(new ofImage("floral/floral.jpg"));
-    textures.push_back(new ofImage("floral/floral_spec.jpg"));
-
-    scene.push_back(new Plane(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), // Floor
-                              ofColor::brown, 50, 50, textures[0], textures[1], 4));
-    scene.push_back(new Plane(glm::vec3(0, 0, -20), glm::vec3(0, 0, 1),
-                              ofColor::gold, 50, 50, textures[2], textures[3], 1)); // Back
+    Plane* floor = new Plane(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor::brown, 50, 50, nullptr, nullptr, 4);
+    floor->setCachedTextures(woodfloor.get(), woodfloorSpecular.get());
+    scene.push_back(floor);
+    Plane* back = new Plane(glm::vec3(0, 0, -20), glm::vec3(0, 0, 1), ofColor::gold, 50, 50, nullptr, nullptr, 1);
+    back->setCachedTextures(floral.get(), floralSpecular.get());
+    scene.push_back(back);
 
     // Lights
     sceneLights.push_back(new PointLight(glm::vec3(1, 8, 0), 400, ofColor::white));
@@ -348,9 +829,24 @@ void ofApp::updateParameters() {
     ambientLight = ambientLightSlider;
     phongPower = phongPowerSlider;
     lightBounces = lightBounceSlider;
+    shadowSamples = shadowSamplesSlider;
+    samplesPerPixel = samplesPerPixelSlider;
+    denoise = denoiseToggle;
+    useWavefront = wavefrontToggle;
+    wavefront.sortSecondaryRays = sortRaysToggle;
+    rasterPrimary = rasterToggle;
+    sceneBVHMethod = lbvhToggle ? BVH::LBVH : BVH::SAH;
+    outlines.thickness = outlineThicknessSlider;
+    reprojectCamera = reprojectToggle;
+    useShadowMaps = shadowMapToggle;
+    shadowMaps.resolution = shadowMapSizeSlider;
+    checkpointRenders = checkpointToggle;
+    lightClusters.cutoff = lightCutoffSlider;
 }
 //--------------------------------------------------------------
 void ofApp::update(){
+    background.update(image);
+    if(background.isRunning()) return;     // The scene and settings stay as they are until the render is done
     updateParameters();
     if(objSelected()) {
         if(bDrag) {
@@ -410,6 +906,9 @@ void ofApp::draw(){
     ofDisableDepthTest();
     renderParamGui.draw();
     objectGui.draw();
+    if(background.isRunning()) {
+        ofDrawBitmapStringHighlight("Rendering " + ofToString(int(background.progress() * 100)) + "%  (x to cancel)", 10, ofGetHeight() - 20);
+    }
 
 }
 
@@ -424,7 +923,7 @@ void ofApp::keyPressed(int key){
             if (!mainCam.getMouseInputEnabled()) mainCam.enableMouseInput();
             break;
         case OF_KEY_BACKSPACE:
-            if (objSelected()) {
+            if (objSelected() && !background.isRunning()) {
                 for(int i = 0; i < selected.size(); i++) {
                     removeObject(selected[i]);
                 }
@@ -438,6 +937,9 @@ void ofApp::keyPressed(int key){
 
 
 void ofApp::keyReleased(int key) {
+    if(background.isRunning() && (key == 'n' || key == 'r' || key == 'p' || key == 'a' || key == 'v')) {
+        return;     // No edits or other renders while one is running
+    }
     switch (key) {
     case OF_KEY_SHIFT:
         bSftKeyDown = false;
@@ -459,9 +961,34 @@ void ofApp::keyReleased(int key) {
         scene.push_back(new Sphere(glm::vec3(0, 0, 0), 1.0, ofColor::violet));
         break;
     case 'r':
-        rayTrace(image);
+        background.start();
+        break;
+    case 'x':
+        background.cancel();
+        break;
+    case 'p': {
+        // Print size render, the height follows the view plane's aspect
+        int width = printWidthSlider;
+        renderStreaming("render.ppm", width, std::max(1, int(round(width / renderCam.view.getAspect()))));
         cout << "done..." << endl;
         break;
+    }
+    case 'v':
+        renderViews("render", imageWidth, imageHeight);
+        cout << "done..." << endl;
+        break;
+    case 'a': {
+        // Render animation.txt if there is one, otherwise a turntable around the spheres
+        AnimationSequence sequence;
+        if(!ofFile::doesFileExist("animation.txt")) {
+            sequence.turntable(renderCam.position, glm::vec3(0, 0, -8), 120);
+        } else if(!sequence.load("animation.txt")) {
+            break;
+        }
+        renderSequence(sequence);
+        cout << "done..." << endl;
+        break;
+    }
     case OF_KEY_F1:
         theCam = &mainCam;
         break;
@@ -486,7 +1013,7 @@ void ofApp::mouseMoved(int x, int y ){
 
 //--------------------------------------------------------------
 void ofApp::mouseDragged(int x, int y, int button) {
-    if (bDrag && objSelected()) {
+    if (bDrag && objSelected() && !background.isRunning()) {
         glm::vec3 point;
         mouseToDragPlane(x, y, point);
         
@@ -587,6 +1114,7 @@ void ofApp::mouseExited(int x, int y){
 
 }
 void ofApp::mouseScrolled(int x, int y, float scrollX, float scrollY) {
+    if(background.isRunning()) return;      // The light is being traced, and its hash recorded with the frame
     if(selected.size() > 0) {
         SpotLight* a = dynamic_cast<SpotLight*>(selected[0]);
         if(a) {
@@ -631,6 +1159,7 @@ void ofApp::dragEvent(ofDragInfo dragInfo){
 }
 ofApp::~ofApp() {
     cout << "Destructor called" << endl;
+    background.cancel();
     for(auto obj : scene) {
         delete obj;
     }
@@ -638,10 +1167,6 @@ ofApp::~ofApp() {
     for(auto light : sceneLights) {
         delete light;
     }
-    for(auto tex : textures) {
-        delete tex;
-    }
-    textures.clear();
     sceneLights.clear();
     image.clear();
 }
@@ -3,6 +3,28 @@
 #include "ofMain.h"
 #include "ofxGui.h"
 #include "Primitives.h"
+#include "ThreadPool.h"
+#include "Animation.h"
+#include "OutOfCoreMesh.h"
+#include "ParticleSet.h"
+#include "Sampling.h"
+#include "RenderBuffer.h"
+#include "Denoiser.h"
+#include "OutlineFilter.h"
+#include "WavefrontRenderer.h"
+#include "Rasterizer.h"
+#include "ImageStream.h"
+#include "RenderServer.h"
+#include "AssetLoader.h"
+#include "EditTracker.h"
+#include "BackgroundRenderer.h"
+#include "Reprojector.h"
+#include "MultiViewRenderer.h"
+#include "ShadowMaps.h"
+#include "RenderCheckpoint.h"
+#include "LightClusters.h"
+
+#define SHADOWOFFSET 50
 
 
 class ofApp : public ofBaseApp {
@@ -29,6 +51,7 @@ class ofApp : public ofBaseApp {
         void drawAxis(glm::vec3 position);
     
         // Initialization functions
+        void parameterSetup();
         void guiSetup();
         void cameraSetup();
         void objectSetup();
@@ -43,19 +66,43 @@ class ofApp : public ofBaseApp {
         bool mouseToDragPlane(int x, int y, glm::vec3& point);
         ofColor scaleColor(ofColor color, float scale);
         SceneObject* shortestIntersection(const Ray& r, glm::vec3& point, glm::vec3& normal);
+        SceneObject* primaryHit(const Ray& cameraRay, int u, int v, glm::vec3& point, glm::vec3& normal);
+        int sceneIndex(SceneObject* obj);
         glm::vec3 reflectVector(glm::vec3 incomingDirection, glm::vec3 normal);
-        bool isShadow(const Ray& shadowRay, BaseLight& light);
+        bool isShadow(const Ray& shadowRay, float distanceToLight);
+        float shadowVisibility(const glm::vec3& origin, BaseLight& light, uint32_t seed);
+        bool lightReaches(SceneObject* obj, const glm::vec3& point, BaseLight& light);
+        bool needsAllLights(SceneObject* obj, int iterations);
+        void buildSceneBVH();
+        void prepareScene(int width);
+        void prepareSceneData();
+        void setPixelFootprint(int width);
+        float pixelFootprint(const glm::vec3& origin, const glm::vec3& point) const { return pixelSize + glm::distance(origin, point) * pixelAngle; }
 
     
         // Raytracing functions
-        ofColor shade(const Ray &incomingRay, BaseLight& light, int iterations);
+        ofColor shade(const Ray &incomingRay, BaseLight& light, int iterations, uint32_t seed);
+        ofColor shadeHit(const Ray& incomingRay, SceneObject* obj, const glm::vec3& point, const glm::vec3& normal, BaseLight& light, int iterations, uint32_t seed);
         ofColor ambient(const Ray& incomingRay);
+        ofColor ambientColor(SceneObject* obj, const glm::vec3& point, float footprint);
         ofColor lambert(const glm::vec3& point, const glm::vec3& normal, const ofColor& diffuse, BaseLight& light, bool celShade);
         ofColor phong(const Ray& ray, const glm::vec3 &point, const glm::vec3 &normal, const ofColor diffuse, float power, BaseLight& light);
         ~ofApp();
-        bool shadowPass(Ray& cameraRay);
-        void rayTracePixel(ofImage& img, const int u, const int v);
+        void rayTracePixel(RenderBuffer& buffer, const int u, const int v, const ViewCamera* view = nullptr);
+        SceneObject* tracePrimary(RenderBuffer& buffer, const int u, const int v, const ViewCamera* view, glm::vec3& point, glm::vec3& normal);
+        void shadePixel(RenderBuffer& buffer, const int u, const int v, const ViewCamera* view, SceneObject* obj, const glm::vec3& point, const glm::vec3& normal,
+                        const vector<int>* lights = nullptr);
+        void rayTrace(ofPixels& pixels);
         void rayTrace(ofImage& img);
+        void renderBand(RenderBuffer& buffer, int width, int imageHeight, int firstRow, int rowCount);
+        void renderRegion(const glm::ivec4& region);
+        uint64_t renderSettings();
+        bool renderStreaming(const string& path, int width, int height);
+        bool renderViews(const string& baseName, int width, int height);
+    
+        // Animation functions
+        void renderSequence(AnimationSequence& sequence);
+        void applyFrameState(const FrameState& state);
     
         // GUI functions
         void addPointLightButtonPressed();
@@ -85,6 +132,20 @@ class ofApp : public ofBaseApp {
         ofParameter<float> ambientLightSlider;
         ofParameter<int> phongPowerSlider;
         ofParameter<int> lightBounceSlider;
+        ofParameter<int> shadowSamplesSlider;
+        ofParameter<int> samplesPerPixelSlider;
+        ofParameter<bool> denoiseToggle;
+        ofParameter<bool> wavefrontToggle;
+        ofParameter<bool> sortRaysToggle;
+        ofParameter<bool> rasterToggle;
+        ofParameter<bool> lbvhToggle;
+        ofParameter<int> outlineThicknessSlider;
+        ofParameter<bool> reprojectToggle;
+        ofParameter<bool> shadowMapToggle;
+        ofParameter<int> shadowMapSizeSlider;
+        ofParameter<bool> checkpointToggle;
+        ofParameter<float> lightCutoffSlider;
+        ofParameter<int> printWidthSlider;
 
         // GUI panel for information about an object
         ofxPanel objectGui;
@@ -101,8 +162,11 @@ class ofApp : public ofBaseApp {
         // Vectors that hold objects and lights
         vector<SceneObject*> scene;
         vector<BaseLight*> sceneLights;
-        vector<ofImage*> textures;
+        AssetLoader assets;
         vector<SceneObject*> selected;
+        BVH sceneBVH;                           // Over boundedObjects, rebuilt at the start of every render
+        vector<SceneObject*> boundedObjects;
+        vector<SceneObject*> unboundedObjects;  // No bounds, tested against every ray
     
         // Placeholder variables for dragging functions
         glm::vec3 lastPoint;
@@ -110,8 +174,32 @@ class ofApp : public ofBaseApp {
 
         // Image parameters
         ofImage image;
+        RenderBuffer renderBuffer;
+        Denoiser denoiser;
+        OutlineFilter outlines;
+        WavefrontRenderer wavefront = WavefrontRenderer(*this);
+        Rasterizer rasterizer;
+        EditTracker edits;                  // What the frame in renderBuffer was rendered from
+        Reprojector reprojection;           // Last frame's points and shading, for camera moves
+        bool reuseHistory = false;          // Set while a frame may take pixels from reprojection
+        BackgroundRenderer background = BackgroundRenderer(*this);
+        MultiViewRenderer multiView = MultiViewRenderer(*this);
+        ShadowMaps shadowMaps = ShadowMaps(*this);
+        RenderCheckpoint checkpoint;
+        LightClusters lightClusters;        // Which lights each primary hit needs, see shadePixel()
+        vector<SceneObject*> stripObjects;  // Centre hits of the strip renderBand() is on, when clustering lights
+        vector<glm::vec3> stripPoints, stripNormals;
+        string checkpointPath = "render.checkpoint";
+        uint64_t sceneContent = 0;          // Hash of the scene file and every file it uses, set by the render server
+        std::atomic<bool> cancelRender{false};                  // Tracing loops stop at the next pixel when set
+        std::function<void(size_t pixels)> renderStarted;       // How many pixels rayTrace() is about to trace
+        std::function<void(const glm::ivec4& tile)> tileDone;   // x, y, width, height of traced rows, called from the workers
+        vector<glm::vec3> tracedColor;      // renderBuffer's colours before the post passes, for re-rendering part of it
         int imageWidth = 2400;
         int imageHeight = 1600;
+        int streamBandPixels = 1 << 20;     // Pixels per band of a streamed render
+        float pixelSize = 0;                // A pixel is pixelSize + distance * pixelAngle wide where a ray
+        float pixelAngle = 0;               // hits at distance, which picks the texture mip level
     
         bool bDrag = false;
         bool bSftKeyDown = false;
@@ -122,4 +210,13 @@ class ofApp : public ofBaseApp {
         float ambientLight;
         float phongPower;
         int lightBounces;
+        int shadowSamples;
+        int samplesPerPixel;
+        bool denoise;
+        bool useWavefront;
+        bool rasterPrimary;
+        bool reprojectCamera = false;
+        bool useShadowMaps = false;         // Preview quality shadows from shadowMaps instead of shadow rays
+        bool checkpointRenders = false;     // Full frame renders save their progress to checkpointPath and resume from it
+        BVH::Method sceneBVHMethod;
 };